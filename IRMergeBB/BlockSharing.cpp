@@ -0,0 +1,432 @@
+//===-- BlockSharing.cpp - Sharing of identical blocks --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Every block keeps its phis and branches to the shared copy, setting the
+/// dispatch value. The copy ends with a switch to continuations, that have
+/// terminators of the original blocks.
+/// Blocks might be executed one after another, so an output of a block is
+/// a single-entry phi in its continuation: the value is fixed, when the copy
+/// returns to this block, and isn't changed by later executions of the copy.
+/// Uses of outputs are rewritten by SSAUpdater, because the switch makes
+/// every continuation reachable after every block.
+/// Shared tails are reached by tail calls, so a suffix of a function becomes
+/// a jump, like cross-jumping does inside a function. Values, which suffixes
+/// use, but don't define, become arguments of the tail.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BlockSharing.h"
+#include "Utilities.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "blocksharing"
+
+using InstIds = DenseMap<const Value *, unsigned>;
+
+/// \return whether \p V is a value of the function
+static bool isLocal(const Value *V) {
+  return isa<Instruction>(V) || isa<Argument>(V);
+}
+
+/// \return whether \p I may be moved into the shared copy
+static bool canBeShared(const Instruction &I) {
+  // allocas of the shared copy would be dynamic
+  if (isa<AllocaInst>(I) || I.isEHPad())
+    return false;
+  // tokens can't be passed through phis
+  if (I.getType()->isTokenTy() ||
+      any_of(I.operands(),
+             [](const Use &U) { return U->getType()->isTokenTy(); }))
+    return false;
+  if (auto *CI = dyn_cast<CallInst>(&I))
+    return !CI->isMustTailCall() && !CI->isConvergent();
+  return true;
+}
+
+/// Checks, that operand \p SiteOp of a block corresponds to \p ModelOp and
+/// records the correspondence of inputs into \p Map, if \p Record is set
+static bool matchOperand(Value *ModelOp, Value *SiteOp,
+                         const InstIds &ModelIds, const InstIds &SiteIds,
+                         DenseMap<Value *, Value *> &Map, bool Record) {
+  auto ModelId = ModelIds.find(ModelOp);
+  auto SiteId = SiteIds.find(SiteOp);
+  if (ModelId != ModelIds.end() || SiteId != SiteIds.end())
+    return ModelId != ModelIds.end() && SiteId != SiteIds.end() &&
+           ModelId->second == SiteId->second;
+
+  if (!isLocal(ModelOp) || !isLocal(SiteOp))
+    // constants are the same, debug info of the model is kept
+    return ModelOp == SiteOp || isa<MetadataAsValue>(ModelOp);
+
+  if (ModelOp->getType() != SiteOp->getType())
+    return false;
+  auto Found = Map.find(ModelOp);
+  if (Found != Map.end())
+    return Found->second == SiteOp;
+  if (Record)
+    Map[ModelOp] = SiteOp;
+  return true;
+}
+
+/// Matches operands of \p Site to operands of \p Model. Operands of
+/// commutative instructions may be swapped
+static bool matchOperands(Instruction *Model, Instruction *Site,
+                          const InstIds &ModelIds, const InstIds &SiteIds,
+                          DenseMap<Value *, Value *> &Map) {
+  auto MatchAll = [&](bool Swapped, bool Record) {
+    for (unsigned j = 0, je = Model->getNumOperands(); j < je; ++j) {
+      unsigned SiteJ = Swapped ? 1 - j : j;
+      if (!matchOperand(Model->getOperand(j), Site->getOperand(SiteJ),
+                        ModelIds, SiteIds, Map, Record))
+        return false;
+    }
+    return true;
+  };
+
+  if (MatchAll(false, false))
+    return MatchAll(false, true);
+  if (Model->isCommutative() && MatchAll(true, false))
+    return MatchAll(true, true);
+  return false;
+}
+
+bool SharedBlocks::match(ArrayRef<BasicBlock *> BBs) {
+  assert(BBs.size() >= 2 && "Nothing to share");
+  Blocks.assign(BBs.begin(), BBs.end());
+  Insts.assign(BBs.size(), {});
+  Inputs.assign(BBs.size(), {});
+  ModelInputs.clear();
+
+  const Function *F = BBs.front()->getParent();
+  std::vector<InstIds> Ids(BBs.size());
+  for (size_t i = 0, ie = BBs.size(); i < ie; ++i) {
+    BasicBlock *BB = BBs[i];
+    if (BB->getParent() != F)
+      return false;
+    for (auto It = utilities::getBeginIt(BB), IE = utilities::getEndIt(BB);
+         It != IE; ++It) {
+      if (!canBeShared(*It))
+        return false;
+      Ids[i][&*It] = Insts[i].size();
+      Insts[i].push_back(&*It);
+    }
+    if (Insts[i].size() != Insts.front().size())
+      return false;
+  }
+
+  for (size_t k = 0, ke = Insts.front().size(); k < ke; ++k) {
+    Instruction *Model = Insts.front()[k];
+    for (Value *Op : Model->operands())
+      if (isLocal(Op) && !Ids.front().count(Op))
+        ModelInputs.insert(Op);
+
+    for (size_t i = 1, ie = BBs.size(); i < ie; ++i) {
+      Instruction *Site = Insts[i][k];
+      if (Site->getOpcode() != Model->getOpcode() ||
+          Site->getType() != Model->getType() ||
+          Site->getNumOperands() != Model->getNumOperands())
+        return false;
+      if (!matchOperands(Model, Site, Ids.front(), Ids[i], Inputs[i]))
+        return false;
+    }
+  }
+
+  for (Value *V : ModelInputs)
+    Inputs.front()[V] = V;
+  return true;
+}
+
+BasicBlock *SharedBlocks::share() {
+  BasicBlock *Model = Blocks.front();
+  Function *F = Model->getParent();
+  LLVMContext &Context = F->getContext();
+  size_t N = Blocks.size();
+  IntegerType *DispatchTy = Type::getInt32Ty(Context);
+
+  // 1) Move terminators into continuations
+  SmallVector<BasicBlock *, 4> Conts;
+  for (BasicBlock *BB : Blocks) {
+    BasicBlock *Cont = BasicBlock::Create(Context, BB->getName() + ".cont", F,
+                                          BB->getNextNode());
+    TerminatorInst *Term = BB->getTerminator();
+    BB->replaceSuccessorsPhiUsesWith(Cont);
+    Term->removeFromParent();
+    Cont->getInstList().push_back(Term);
+    Conts.push_back(Cont);
+  }
+
+  // 2) Create the shared copy with phis of dispatch value and inputs, which
+  // differ between blocks
+  BasicBlock *Shared = BasicBlock::Create(Context, Model->getName() + ".shared",
+                                          F, Conts.front());
+  IRBuilder<> Builder(Shared);
+  PHINode *Dispatch = Builder.CreatePHI(DispatchTy, N, "dispatch");
+  DenseMap<Value *, PHINode *> InputPhis;
+  for (Value *V : ModelInputs) {
+    bool Same = all_of(Inputs, [V](const DenseMap<Value *, Value *> &Map) {
+      return Map.lookup(V) == V;
+    });
+    if (!Same)
+      InputPhis[V] = Builder.CreatePHI(V->getType(), N, V->getName());
+  }
+
+  for (size_t i = 0; i < N; ++i) {
+    Dispatch->addIncoming(ConstantInt::get(DispatchTy, i), Blocks[i]);
+    for (auto &Input : InputPhis)
+      Input.second->addIncoming(Inputs[i].lookup(Input.first), Blocks[i]);
+    BranchInst::Create(Shared, Blocks[i]);
+  }
+
+  for (Instruction *I : Insts.front()) {
+    I->removeFromParent();
+    Shared->getInstList().push_back(I);
+    for (Use &U : I->operands()) {
+      auto Found = InputPhis.find(U.get());
+      if (Found != InputPhis.end())
+        U.set(Found->second);
+    }
+  }
+
+  SwitchInst *Switch =
+      SwitchInst::Create(Dispatch, Conts.front(), N - 1, Shared);
+  for (size_t i = 1; i < N; ++i)
+    Switch->addCase(ConstantInt::get(DispatchTy, i), Conts[i]);
+
+  // 3) Replace outputs of every block with single-entry phis
+  SSAUpdater Updater;
+  for (size_t i = 0; i < N; ++i) {
+    SmallPtrSet<const Instruction *, 16> Site(Insts[i].begin(),
+                                              Insts[i].end());
+    for (size_t k = 0, ke = Insts[i].size(); k < ke; ++k) {
+      Instruction *I = Insts[i][k];
+      SmallVector<Use *, 8> Uses;
+      for (Use &U : I->uses())
+        if (!Site.count(cast<Instruction>(U.getUser())))
+          Uses.push_back(&U);
+      if (Uses.empty())
+        continue;
+
+      PHINode *Copy = PHINode::Create(I->getType(), 1, I->getName(),
+                                      &Conts[i]->front());
+      Copy->addIncoming(Insts.front()[k], Shared);
+      Updater.Initialize(I->getType(), I->getName());
+      Updater.AddAvailableValue(Conts[i], Copy);
+      for (Use *U : Uses) {
+        auto *UI = cast<Instruction>(U->getUser());
+        // SSAUpdater computes values before definitions in the block
+        if (UI->getParent() == Conts[i] && !isa<PHINode>(UI))
+          U->set(Copy);
+        else
+          Updater.RewriteUse(*U);
+      }
+    }
+  }
+
+  // 4) Erase merged parts of other blocks, users go first
+  for (size_t i = 1; i < N; ++i)
+    for (Instruction *I : reverse(Insts[i]))
+      I->eraseFromParent();
+
+  return Shared;
+}
+
+////////// Sharing of common tails //////////
+
+/// \return whether \p I may be moved into the shared tail
+static bool canBeTail(const Instruction &I) {
+  // debug intrinsics may refer to values, which aren't passed to the tail
+  return canBeShared(I) && !isa<DbgInfoIntrinsic>(I);
+}
+
+/// \return whether instructions of \p L are valid in \p R
+static bool hasSameTarget(const Function &L, const Function &R) {
+  for (StringRef Kind : {"target-cpu", "target-features"})
+    if (L.getFnAttribute(Kind).getValueAsString() !=
+        R.getFnAttribute(Kind).getValueAsString())
+      return false;
+  return true;
+}
+
+bool SharedTail::isCandidate(const Function &F) {
+  if (F.isDeclaration() || F.size() != 1 || F.isVarArg() || !F.hasName())
+    return false;
+  const BasicBlock &BB = F.front();
+  if (!isa<ReturnInst>(BB.getTerminator()))
+    return false;
+  // the tail is called with tail marker, so it mustn't access the frame of
+  // the caller
+  for (const Argument &Arg : F.args())
+    if (Arg.hasByValOrInAllocaAttr() || Arg.hasSwiftErrorAttr())
+      return false;
+  return none_of(BB, [](const Instruction &I) { return isa<AllocaInst>(I); });
+}
+
+size_t SharedTail::hashTail(const Function &F, size_t Length) {
+  const BasicBlock &BB = F.front();
+  hash_code Hash = hash_value(Length);
+  size_t i = 0;
+  for (auto It = BB.rbegin(), IE = BB.rend(); It != IE && i < Length;
+       ++It, ++i)
+    Hash = hash_combine(Hash, It->getOpcode(), It->getType());
+  return Hash;
+}
+
+size_t SharedTail::getCommonLength(Function &Model, Function &F) {
+  const BasicBlock &ModelBB = Model.front();
+  const BasicBlock &BB = F.front();
+  // operations limit the length, operands are checked by matching
+  size_t MaxLength = 0;
+  for (auto MIt = ModelBB.rbegin(), MIE = ModelBB.rend(), It = BB.rbegin(),
+            IE = BB.rend();
+       MIt != MIE && It != IE; ++MIt, ++It, ++MaxLength)
+    if (!canBeTail(*MIt) || !It->isSameOperationAs(&*MIt))
+      break;
+
+  SharedTail Tail;
+  Function *Pair[] = {&Model, &F};
+  for (size_t Length = MaxLength; Length > 0; --Length)
+    if (Tail.match(Pair, Length))
+      return Length;
+  return 0;
+}
+
+bool SharedTail::match(ArrayRef<Function *> Fs, size_t Length) {
+  assert(Fs.size() >= 2 && "Nothing to share");
+  Funcs.assign(Fs.begin(), Fs.end());
+  Insts.assign(Fs.size(), {});
+  Inputs.assign(Fs.size(), {});
+  ModelInputs.clear();
+
+  const Function *Model = Fs.front();
+  std::vector<InstIds> Ids(Fs.size());
+  for (size_t i = 0, ie = Fs.size(); i < ie; ++i) {
+    BasicBlock &BB = Fs[i]->front();
+    if (Length == 0 || Length > BB.size() || !hasSameTarget(*Model, *Fs[i]))
+      return false;
+    for (Instruction &I : make_range(std::prev(BB.end(), Length), BB.end())) {
+      if (!canBeTail(I))
+        return false;
+      Ids[i][&I] = Insts[i].size();
+      Insts[i].push_back(&I);
+    }
+  }
+
+  for (size_t k = 0; k < Length; ++k) {
+    Instruction *ModelI = Insts.front()[k];
+    for (Value *Op : ModelI->operands())
+      if (isLocal(Op) && !Ids.front().count(Op))
+        ModelInputs.insert(Op);
+
+    for (size_t i = 1, ie = Fs.size(); i < ie; ++i) {
+      Instruction *Site = Insts[i][k];
+      // flags and special state are compared too, blocks aren't known to be
+      // identical here
+      if (!Site->isSameOperationAs(ModelI))
+        return false;
+      if (!matchOperands(ModelI, Site, Ids.front(), Ids[i], Inputs[i]))
+        return false;
+    }
+  }
+
+  for (Value *V : ModelInputs)
+    Inputs.front()[V] = V;
+  return true;
+}
+
+bool SharedTail::isWholeModel() const {
+  Function *Model = Funcs.front();
+  if (Insts.front().size() != Model->front().size() || Model->isInterposable())
+    return false;
+  // every argument gets a value of a caller, which satisfies no attributes
+  const AttributeList &Attrs = Model->getAttributes();
+  return all_of(Model->args(), [&](Argument &Arg) {
+    return ModelInputs.count(&Arg) &&
+           !Attrs.getParamAttributes(Arg.getArgNo()).hasAttributes();
+  });
+}
+
+Function *SharedTail::share(StringRef Name) {
+  Function *Model = Funcs.front();
+  LLVMContext &Context = Model->getContext();
+
+  // 1) Take the model or move its suffix into the created tail
+  SmallVector<Value *, 8> Params;
+  Function *Tail = Model;
+  if (isWholeModel()) {
+    for (Argument &Arg : Model->args())
+      Params.push_back(&Arg);
+  } else {
+    Params.assign(ModelInputs.begin(), ModelInputs.end());
+    SmallVector<Type *, 8> Types;
+    for (Value *V : Params)
+      Types.push_back(V->getType());
+    Tail = Function::Create(
+        FunctionType::get(Model->getReturnType(), Types, false),
+        GlobalValue::PrivateLinkage, Name, Model->getParent());
+    Tail->setCallingConv(Model->getCallingConv());
+    Tail->addAttributes(
+        AttributeList::FunctionIndex,
+        AttrBuilder(Model->getAttributes(), AttributeList::FunctionIndex));
+    if (Model->hasSection())
+      Tail->setSection(Model->getSection());
+
+    DenseMap<Value *, Value *> Args;
+    auto ArgIt = Tail->arg_begin();
+    for (Value *V : Params) {
+      ArgIt->setName(V->getName());
+      Args[V] = &*ArgIt++;
+    }
+    BasicBlock *Entry = BasicBlock::Create(Context, "Entry", Tail);
+    for (Instruction *I : Insts.front()) {
+      I->removeFromParent();
+      Entry->getInstList().push_back(I);
+      for (Use &U : I->operands()) {
+        auto Found = Args.find(U.get());
+        if (Found != Args.end())
+          U.set(Found->second);
+      }
+    }
+  }
+
+  // 2) Replace suffixes with tail calls
+  for (size_t i = 0, ie = Funcs.size(); i < ie; ++i) {
+    if (Funcs[i] == Tail)
+      continue;
+    BasicBlock &BB = Funcs[i]->front();
+    DebugLoc Loc = Insts[i].front()->getDebugLoc();
+    SmallVector<Value *, 8> Args;
+    for (Value *V : Params)
+      Args.push_back(Inputs[i].lookup(V));
+    // suffix of the model is already moved, users go first
+    if (i != 0)
+      for (Instruction *I : reverse(Insts[i]))
+        I->eraseFromParent();
+
+    CallInst *Call = CallInst::Create(Tail, Args, "", &BB);
+    Call->setCallingConv(Tail->getCallingConv());
+    // candidates have no allocas
+    Call->setTailCallKind(CallInst::TailCallKind::TCK_Tail);
+    Call->setDebugLoc(Loc);
+    ReturnInst::Create(Context,
+                       Tail->getReturnType()->isVoidTy() ? nullptr : Call, &BB);
+  }
+  return Tail;
+}
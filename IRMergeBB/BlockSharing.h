@@ -0,0 +1,102 @@
+//===-- BlockSharing.h - Sharing of identical blocks ------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file contains alternative to outlining for identical basic blocks of
+/// the same function: merged parts of blocks are replaced with a branch to
+/// a single shared copy, which returns to the right continuation by switch.
+/// It also contains sharing of common tails of single-block functions, which
+/// jump to a single copy of the tail instead of keeping their own
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMTRANSFORM_BLOCKSHARING_H
+#define LLVMTRANSFORM_BLOCKSHARING_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <vector>
+
+namespace llvm {
+
+class BasicBlock;
+class Function;
+class Instruction;
+class Value;
+
+/// Correspondence of values of identical blocks of the same function. The
+/// first block is the model: its merged part becomes the shared copy
+class SharedBlocks {
+public:
+  /// Matches merged parts of \p BBs instruction by instruction
+  /// \return false, if blocks can't share a copy of their merged part
+  bool match(ArrayRef<BasicBlock *> BBs);
+
+  /// Replaces merged parts of matched blocks with branches to the shared
+  /// copy. Inputs of the copy and dispatch value are phis, outputs are
+  /// single-entry phis in continuations, so values stay in SSA form
+  /// \return the shared block
+  BasicBlock *share();
+
+private:
+  SmallVector<BasicBlock *, 4> Blocks;
+  /// Merged instructions of every block
+  std::vector<SmallVector<Instruction *, 16>> Insts;
+  /// Values, defined outside of the model merged part, in order of use
+  SetVector<Value *> ModelInputs;
+  /// Model input -> corresponding value of every block
+  std::vector<DenseMap<Value *, Value *>> Inputs;
+};
+
+/// Common suffix of single-block functions, including the return. The
+/// first function is the model: its suffix becomes the shared tail, which
+/// takes values, defined before the suffix, as arguments
+class SharedTail {
+public:
+  /// \return whether suffixes of \p F may be shared
+  static bool isCandidate(const Function &F);
+
+  /// \return hash of opcodes of the last \p Length instructions of
+  /// candidate \p F. Functions with a common tail of this length have
+  /// equal hashes
+  static size_t hashTail(const Function &F, size_t Length);
+
+  /// \return number of the last instructions of candidates \p Model and
+  /// \p F, that can be shared
+  static size_t getCommonLength(Function &Model, Function &F);
+
+  /// Matches the last \p Length instructions of candidates \p Fs
+  /// \return false, if functions can't share a tail of this length
+  bool match(ArrayRef<Function *> Fs, size_t Length);
+
+  /// \return whether the tail is the whole body of the model, so other
+  /// functions call the model itself
+  bool isWholeModel() const;
+
+  /// Replaces matched suffixes with tail calls of the shared tail. The tail
+  /// is created as a private function \p Name, unless the model is used
+  /// \return the shared tail
+  Function *share(StringRef Name);
+
+private:
+  SmallVector<Function *, 4> Funcs;
+  /// Suffix of every function
+  std::vector<SmallVector<Instruction *, 16>> Insts;
+  /// Values, defined before the model suffix, in order of use
+  SetVector<Value *> ModelInputs;
+  /// Model input -> corresponding value of every function
+  std::vector<DenseMap<Value *, Value *>> Inputs;
+};
+
+} // namespace llvm
+
+#endif // LLVMTRANSFORM_BLOCKSHARING_H
@@ -12,6 +12,7 @@
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
+#include <cstring>
 
 using namespace llvm;
 
@@ -109,22 +110,28 @@ public:
 BBComparator::BasicBlockHash
 BBComparator::basicBlockHash(const BasicBlock &BB) {
   HashAccumulator64 H;
-  auto IE = std::prev(BB.end());
-  auto I = BB.begin();
-  for (; isa<PHINode>(I); ++I)
-    ;
-
-  for (; I != IE; ++I)
+  for (auto I = utilities::getBeginIt(&BB), IE = utilities::getEndIt(&BB);
+       I != IE; ++I)
     H.add(I->getOpcode());
   return H.getHash();
 }
 
-static int cmpSpecialFnAttrs(const AttributeSet LF, const AttributeSet RF) {
-  Attribute::AttrKind Attributes[] = {
-      Attribute::MinSize, Attribute::NoImplicitFloat, Attribute::OptimizeNone,
-      Attribute::OptimizeForSize};
+static const Attribute::AttrKind SpecialAttributes[] = {
+    Attribute::MinSize, Attribute::NoImplicitFloat, Attribute::OptimizeNone,
+    Attribute::OptimizeForSize};
+
+static const StringRef SpecialStringAttributes[] = {
+    "target-cpu",
+    "target-features",
+    "correctly-rounded-divide-sqrt-fp-math",
+    "less-precise-fpmad",
+    "no-infs-fp-math",
+    "no-nans-fp-math",
+    "no-signed-zeros-fp-math",
+    "no-trapping-math"};
 
-  for (auto A : Attributes) {
+static int cmpSpecialFnAttrs(const AttributeSet LF, const AttributeSet RF) {
+  for (auto A : SpecialAttributes) {
     bool L = LF.hasFnAttribute(A);
     bool R = RF.hasFnAttribute(A);
     if (L < R)
@@ -133,16 +140,7 @@ static int cmpSpecialFnAttrs(const AttributeSet LF, const AttributeSet RF) {
       return 1;
   }
 
-  StringRef StringAttributes[] = {"target-cpu",
-                                  "target-features",
-                                  "correctly-rounded-divide-sqrt-fp-math",
-                                  "less-precise-fpmad",
-                                  "no-infs-fp-math",
-                                  "no-nans-fp-math",
-                                  "no-signed-zeros-fp-math",
-                                  "no-trapping-math"};
-
-  for (auto A : StringAttributes) {
+  for (auto A : SpecialStringAttributes) {
     bool L = LF.hasFnAttribute(A);
     bool R = RF.hasFnAttribute(A);
     if (L < R)
@@ -183,3 +181,188 @@ int BBComparator::compareSignatures() const {
   }
   return 0;
 }
+
+////////// Encoding of basic blocks //////////
+
+namespace {
+enum OperandKind : uint32_t { OK_Value, OK_Constant, OK_InlineAsm, OK_Self };
+} // end anonymous namespace
+
+// Types are encoded the same way as FunctionComparator::cmpTypes compares
+// them: pointers of address space 0 are integers and structures are compared
+// by their elements
+uint32_t BBEncodingTable::getTypeId(Type *T, const DataLayout &DL) {
+  auto *PT = dyn_cast<PointerType>(T);
+  if (PT && PT->getAddressSpace() == 0)
+    T = DL.getIntPtrType(T);
+
+  auto Cached = TypeCache.find(T);
+  if (Cached != TypeCache.end())
+    return Cached->second;
+
+  std::vector<uint64_t> Key{T->getTypeID()};
+  switch (T->getTypeID()) {
+  case Type::IntegerTyID:
+    Key.push_back(cast<IntegerType>(T)->getBitWidth());
+    break;
+  case Type::PointerTyID:
+    Key.push_back(T->getPointerAddressSpace());
+    break;
+  case Type::StructTyID: {
+    auto *ST = cast<StructType>(T);
+    Key.push_back(ST->getNumElements());
+    Key.push_back(ST->isPacked());
+    for (Type *Elem : ST->elements())
+      Key.push_back(getTypeId(Elem, DL));
+    break;
+  }
+  case Type::FunctionTyID: {
+    auto *FT = cast<FunctionType>(T);
+    Key.push_back(FT->getNumParams());
+    Key.push_back(FT->isVarArg());
+    Key.push_back(getTypeId(FT->getReturnType(), DL));
+    for (Type *Param : FT->params())
+      Key.push_back(getTypeId(Param, DL));
+    break;
+  }
+  case Type::ArrayTyID:
+  case Type::VectorTyID: {
+    auto *ST = cast<SequentialType>(T);
+    Key.push_back(ST->getNumElements());
+    Key.push_back(getTypeId(ST->getElementType(), DL));
+    break;
+  }
+  default:
+    // the rest of types are compared by their TypeID
+    break;
+  }
+
+  uint32_t Id =
+      TypeKeys.insert(std::make_pair(std::move(Key), TypeKeys.size()))
+          .first->second;
+  TypeCache[T] = Id;
+  return Id;
+}
+
+// Functions of the same class are equal due to compareSignatures
+uint32_t BBEncodingTable::getSignatureClass(const Function &F) {
+  std::string Key;
+  for (auto A : SpecialAttributes)
+    Key += F.hasFnAttribute(A) ? '1' : '0';
+  for (auto A : SpecialStringAttributes)
+    Key += F.hasFnAttribute(A) ? '1' : '0';
+  Key += F.hasGC() ? '1' : '0';
+  if (F.hasGC())
+    Key += F.getGC();
+  Key += '\0';
+  Key += F.hasSection() ? '1' : '0';
+  if (F.hasSection())
+    Key += F.getSection();
+
+  return SignatureKeys.insert(std::make_pair(Key, SignatureKeys.size()))
+      .first->second;
+}
+
+// Values are numbered in order of their first use like in sn_map of
+// FunctionComparator. Numbering of a subset of compared operands keeps
+// equal blocks equal, so operands of commutative instructions, which might be
+// compared swapped, aren't numbered
+BBEncodingTable::Operand
+BBEncodingTable::encodeOperand(const Value *V, const Function *Parent,
+                               const DataLayout &DL, bool Numbered) {
+  Operand Result{OK_Value, 0, getTypeId(V->getType(), DL)};
+  if (V == Parent)
+    Result.Kind = OK_Self;
+  else if (isa<Constant>(V))
+    Result.Kind = OK_Constant;
+  else if (isa<InlineAsm>(V))
+    Result.Kind = OK_InlineAsm;
+  else if (Numbered)
+    Result.Index =
+        ValueNumbers.insert(std::make_pair(V, ValueNumbers.size()))
+            .first->second;
+  return Result;
+}
+
+BBEncodingTable::EncodingId BBEncodingTable::encode(const BasicBlock &BB) {
+  const Function *F = BB.getParent();
+  const DataLayout &DL = F->getParent()->getDataLayout();
+  ValueNumbers.clear();
+
+  Entry E;
+  E.Signature = getSignatureClass(*F);
+  E.InstBegin = Opcodes.size();
+  E.OpBegin = Operands.size();
+
+  for (auto I = utilities::getBeginIt(&BB), IE = utilities::getEndIt(&BB);
+       I != IE; ++I) {
+    Opcodes.push_back(static_cast<uint16_t>(I->getOpcode()));
+    // GEPs are compared by their offsets, so their types and operands are
+    // not the part of encoding
+    if (isa<GetElementPtrInst>(&*I)) {
+      TypeIds.push_back(0);
+      Flags.push_back(0);
+      continue;
+    }
+    TypeIds.push_back(getTypeId(I->getType(), DL));
+    Flags.push_back(static_cast<uint8_t>(I->getRawSubclassOptionalData()));
+
+    bool Commutative = I->isCommutative();
+    size_t OpBegin = Operands.size();
+    for (const Value *Op : I->operands())
+      Operands.push_back(encodeOperand(Op, F, DL, !Commutative));
+    if (Commutative)
+      std::sort(Operands.begin() + OpBegin, Operands.end(),
+                [](const Operand &L, const Operand &R) {
+                  return std::tie(L.Kind, L.TypeId) <
+                         std::tie(R.Kind, R.TypeId);
+                });
+  }
+
+  E.InstEnd = Opcodes.size();
+  E.OpEnd = Operands.size();
+  Entries.push_back(E);
+  return Entries.size() - 1;
+}
+
+template <typename T>
+static int compareRanges(const std::vector<T> &V, uint32_t LBegin,
+                         uint32_t LEnd, uint32_t RBegin, uint32_t REnd) {
+  size_t LSize = LEnd - LBegin;
+  size_t RSize = REnd - RBegin;
+  if (LSize != RSize)
+    return LSize < RSize ? -1 : 1;
+  if (LSize == 0)
+    return 0;
+  return std::memcmp(&V[LBegin], &V[RBegin], LSize * sizeof(T));
+}
+
+int BBEncodingTable::compare(EncodingId LId, EncodingId RId) const {
+  static_assert(sizeof(Operand) == 3 * sizeof(uint32_t),
+                "Operand shouldn't have padding");
+  const Entry &L = Entries[LId];
+  const Entry &R = Entries[RId];
+  if (L.Signature != R.Signature)
+    return L.Signature < R.Signature ? -1 : 1;
+  if (int Res =
+          compareRanges(Opcodes, L.InstBegin, L.InstEnd, R.InstBegin, R.InstEnd))
+    return Res;
+  if (int Res =
+          compareRanges(TypeIds, L.InstBegin, L.InstEnd, R.InstBegin, R.InstEnd))
+    return Res;
+  if (int Res =
+          compareRanges(Flags, L.InstBegin, L.InstEnd, R.InstBegin, R.InstEnd))
+    return Res;
+  return compareRanges(Operands, L.OpBegin, L.OpEnd, R.OpBegin, R.OpEnd);
+}
+
+void BBEncodingTable::clear() {
+  Entries.clear();
+  Opcodes.clear();
+  TypeIds.clear();
+  Flags.clear();
+  Operands.clear();
+  TypeCache.clear();
+  TypeKeys.clear();
+  SignatureKeys.clear();
+}
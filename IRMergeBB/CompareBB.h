@@ -10,7 +10,10 @@
 #ifndef LLVMTRANSFORM_BBCOMPARING_H
 #define LLVMTRANSFORM_BBCOMPARING_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Transforms/Utils/FunctionComparator.h"
+#include <map>
+#include <vector>
 
 namespace llvm {
 
@@ -30,6 +33,57 @@ private:
   int compareInstOperands(const Instruction *IL, const Instruction *IR) const;
 };
 
+/// Compact encoding of candidate basic blocks, stored in contiguous arrays:
+/// opcodes, type ids, optional flags and operand tuples of merged parts of
+/// blocks and signature classes of their functions.
+/// Blocks, equal due to BBComparator, have equal encodings, so comparing
+/// encodings with memcmp rejects most of unequal blocks without touching IR.
+class BBEncodingTable {
+public:
+  typedef unsigned EncodingId;
+
+  EncodingId encode(const BasicBlock &BB);
+
+  /// Three-way comparison of encodings. It is a total order, where equal
+  /// blocks are equivalent
+  int compare(EncodingId L, EncodingId R) const;
+
+  void clear();
+
+private:
+  /// Operand kind, index of value in order of the first use and type id.
+  /// Fields have the same size, so there is no padding for memcmp
+  struct Operand {
+    uint32_t Kind;
+    uint32_t Index;
+    uint32_t TypeId;
+  };
+
+  struct Entry {
+    uint32_t Signature;
+    uint32_t InstBegin, InstEnd;
+    uint32_t OpBegin, OpEnd;
+  };
+
+  uint32_t getTypeId(Type *T, const DataLayout &DL);
+  uint32_t getSignatureClass(const Function &F);
+  Operand encodeOperand(const Value *V, const Function *Parent,
+                        const DataLayout &DL, bool Numbered);
+
+  std::vector<Entry> Entries;
+  std::vector<uint16_t> Opcodes;
+  std::vector<uint32_t> TypeIds;
+  std::vector<uint8_t> Flags;
+  std::vector<Operand> Operands;
+
+  /// Types, equal due to FunctionComparator::cmpTypes, have the same id
+  DenseMap<Type *, uint32_t> TypeCache;
+  std::map<std::vector<uint64_t>, uint32_t> TypeKeys;
+  std::map<std::string, uint32_t> SignatureKeys;
+  /// Numbers of values of the block, that is being encoded
+  DenseMap<const Value *, uint32_t> ValueNumbers;
+};
+
 } // namespace llvm
 
 #endif // LLVMTRANSFORM_BBCOMPARING_H
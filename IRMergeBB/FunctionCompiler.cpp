@@ -9,21 +9,34 @@
 //===----------------------------------------------------------------------===//
 
 #include "FunctionCompiler.h"
+#include "MachineCodeSize.h"
+#include "Utilities.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/CodeGen/TargetPassConfig.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Mutex.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetLowering.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 
-// TODO: calculate unwind info, when computing function sizes
 // TODO: it is also possible to map metadata. Will metadata mapping increase
 // accuracy of exact size?
 // TODO: now we are unable to include CommandFlags because of
@@ -35,6 +48,22 @@
 
 using namespace llvm;
 
+static cl::opt<bool> MeasureMachineCode(
+    "mergebb-mc-size",
+    cl::desc("Measure function sizes from machine code instead of emitting "
+             "and parsing object files"),
+    cl::init(false));
+
+static cl::opt<unsigned> CodegenThreads(
+    "mergebb-codegen-threads", cl::Hidden, cl::init(1),
+    cl::desc("Number of threads, compiling parts of a large module of a "
+             "single cost evaluation"));
+
+static cl::opt<unsigned> CodegenSplitMin(
+    "mergebb-codegen-split-min", cl::Hidden, cl::init(64),
+    cl::desc("Minimal number of defined functions in the module of a cost "
+             "evaluation, which is compiled in parts"));
+
 static Function *CreateFunction(const Function &F, Module *M,
                                 const StringRef NewName) {
   assert(M->getFunction(NewName) == nullptr && "Function already exists");
@@ -82,80 +111,254 @@ Value *ModuleMaterializer::materialize(Value *V) {
   return nullptr;
 }
 
-// initializes all necessary info for calculating size
-static void initializeAdditionInfo() {
+namespace {
+struct BackendInitializer {
+  const char *Name;
+  void (*Initialize)();
+};
+} // end anonymous namespace
+
+// Initializers of every configured backend. Arrays end with empty element,
+// because some of .def files may be empty
+#define LLVM_TARGET(TargetName)                                                \
+  {#TargetName, LLVMInitialize##TargetName##Target},
+static const BackendInitializer TargetInitializers[] = {
+#include "llvm/Config/Targets.def"
+    {nullptr, nullptr}};
+
+#define LLVM_TARGET(TargetName)                                                \
+  {#TargetName, LLVMInitialize##TargetName##TargetMC},
+static const BackendInitializer MCInitializers[] = {
+#include "llvm/Config/Targets.def"
+    {nullptr, nullptr}};
+
+#define LLVM_ASM_PRINTER(TargetName)                                           \
+  {#TargetName, LLVMInitialize##TargetName##AsmPrinter},
+static const BackendInitializer AsmPrinterInitializers[] = {
+#include "llvm/Config/AsmPrinters.def"
+    {nullptr, nullptr}};
+
+/// \return true, if backend \p Name was found in \p Initializers
+static bool initializeBackend(const BackendInitializer *Initializers,
+                              StringRef Name) {
+  for (auto I = Initializers; I->Name; ++I) {
+    if (Name.equals_lower(I->Name)) {
+      I->Initialize();
+      return true;
+    }
+  }
+  return false;
+}
+
+/// \return name of the backend in Targets.def, which registers targets of
+/// \p T. It is the prefix of intrinsics of the architecture except of few
+static StringRef getBackendName(const Triple &T) {
+  StringRef Prefix = Triple::getArchTypePrefix(T.getArch());
+  return StringSwitch<StringRef>(Prefix)
+      .Case("ppc", "PowerPC")
+      .Case("s390", "SystemZ")
+      .Cases("amdgcn", "r600", "AMDGPU")
+      .Case("nvvm", "NVPTX")
+      .Case("wasm", "WebAssembly")
+      .Default(Prefix);
+}
+
+// initializes necessary info for calculating size only for the target of
+// \p TripleName instead of all configured targets
+static const Target *initializeTarget(const std::string &TripleName,
+                                      std::string &Error) {
+  // target infos are cheap and are needed to find the target by triple
+  InitializeAllTargetInfos();
+  const Target *TheTarget = TargetRegistry::lookupTarget(TripleName, Error);
+  if (!TheTarget)
+    return nullptr;
+
+  // e.g. opt initializes everything by itself
+  if (TheTarget->hasTargetMachine() && TheTarget->hasMCAsmBackend())
+    return TheTarget;
+
+  // only the backend, which owns the target, is initialized
+  StringRef Backend = getBackendName(Triple(TripleName));
+  if (!Backend.empty() && initializeBackend(TargetInitializers, Backend) &&
+      TheTarget->hasTargetMachine()) {
+    initializeBackend(MCInitializers, Backend);
+    initializeBackend(AsmPrinterInitializers, Backend);
+    if (TheTarget->hasMCAsmBackend())
+      return TheTarget;
+  }
+
   InitializeAllTargets();
   InitializeAllTargetMCs();
-  InitializeAllTargetInfos();
   InitializeAllAsmPrinters();
+  return TheTarget;
 }
 
-static void copyModuleInfo(const Module &From, Module &To) {
-  To.setTargetTriple(From.getTargetTriple());
-  To.setDataLayout(From.getDataLayout());
-  To.setPICLevel(From.getPICLevel());
-  To.setPIELevel(From.getPIELevel());
-}
+////////// Code generation pipelines cache //////////
 
-FunctionCompiler::FunctionCompiler(const Module &OtherM)
-    : M(make_unique<Module>("FunctionCost_auxiliary", OtherM.getContext())),
-      Materializer(make_unique<ModuleMaterializer>(*M)), OS(OSBuf),
-      IsInitialized(false) {
+/// Target machine and code generation passes, which emit object file into
+/// the inner buffer or measure machine code (-mergebb-mc-size). Their
+/// creation is expensive, so pipelines are cached for the whole process and
+/// reused by FunctionCompilers with the same triple, CPU and features.
+/// Pipeline is used by one FunctionCompiler at once. Pipelines, which hash
+/// machine basic blocks, measure machine code as well
+class CodeGenPipeline {
+public:
+  static std::unique_ptr<CodeGenPipeline> create(const std::string &TripleName,
+                                                 const std::string &CPU,
+                                                 const std::string &Features,
+                                                 bool HashBlocks = false);
+
+  static std::string getKey(StringRef TripleName, StringRef CPU,
+                            StringRef Features, bool HashBlocks = false) {
+    return (TripleName + Twine('\0') + CPU + Twine('\0') + Features +
+            Twine('\0') +
+            (HashBlocks ? "hash" : MeasureMachineCode ? "mc" : "obj"))
+        .str();
+  }
 
-  std::string TripleName =
-      OtherM.getTargetTriple().empty()
-          ? Triple::normalize(sys::getDefaultTargetTriple())
-          : Triple::normalize(OtherM.getTargetTriple());
+  const std::string &getKey() const { return Key; }
 
-  copyModuleInfo(OtherM, *M);
-  M->setTargetTriple(TripleName);
-  // initialize copying info
-  Mapper = make_unique<ValueMapper>(VtoV, RF_NullMapMissingGlobalValues,
-                                    nullptr, Materializer.get());
+  TargetMachine &getTargetMachine() { return *TM; }
 
-  // initialize compiling info
-  initializeAdditionInfo();
+  /// \return buffer with object file of \p M. Buffer is empty, if pipeline
+  /// measures machine code
+  StringRef emit(Module &M) {
+    OSBuf.clear();
+    Sizes.clear();
+    PM.run(M);
+    return StringRef(OSBuf.data(), OSBuf.size());
+  }
 
-  std::string CPUStr;      // = getCPUStr();
-  std::string FeaturesStr; // = getFeaturesStr();
+  bool measuresMachineCode() const { return MeasuresMachineCode; }
+
+  /// Sizes, measured by the last emit, if pipeline measures machine code
+  const MachineCodeSizes &getSizes() const { return Sizes; }
 
+private:
+  CodeGenPipeline() : OS(OSBuf) {}
+
+  std::string Key;
+  bool MeasuresMachineCode = false;
+  MachineCodeSizes Sizes;
+  std::unique_ptr<TargetMachine> TM;
+  legacy::PassManager PM;
+  SmallVector<char, 1024> OSBuf;
+  raw_svector_ostream OS;
+};
+
+std::unique_ptr<CodeGenPipeline>
+CodeGenPipeline::create(const std::string &TripleName, const std::string &CPU,
+                        const std::string &Features, bool HashBlocks) {
   std::string ErrorStr;
 
-  const Target *TheTarget = TargetRegistry::lookupTarget(TripleName, ErrorStr);
+  const Target *TheTarget = initializeTarget(TripleName, ErrorStr);
 
   if (!TheTarget) {
     DEBUG(dbgs() << "Can't get target\n");
     DEBUG(dbgs() << ErrorStr);
-    return;
+    return nullptr;
   }
 
+  std::unique_ptr<CodeGenPipeline> Result(new CodeGenPipeline());
+  Result->Key = getKey(TripleName, CPU, Features, HashBlocks);
+
   // TargetOptions Options = InitTargetOptionsFromCodeGenFlags();
   TargetOptions Options;
 
-  TM.reset(TheTarget->createTargetMachine(TripleName, CPUStr, FeaturesStr,
-                                          Options, Optional<Reloc::Model>()));
-  M->setDataLayout(TM->createDataLayout());
+  Result->TM.reset(TheTarget->createTargetMachine(
+      TripleName, CPU, Features, Options, Optional<Reloc::Model>()));
 
-  if (!TM.get()) {
+  if (!Result->TM) {
     DEBUG(dbgs() << "Can't create TargetMachine\n");
-    return;
+    return nullptr;
   }
 
   TargetLibraryInfoImpl TLII = TargetLibraryInfoImpl(Triple(TripleName));
 
-  PM.add(new TargetLibraryInfoWrapperPass(TLII));
+  Result->PM.add(new TargetLibraryInfoWrapperPass(TLII));
 
-  if (TM->addPassesToEmitFile(PM, OS, TargetMachine::CGFT_ObjectFile)) {
+  Result->MeasuresMachineCode = MeasureMachineCode || HashBlocks;
+  bool Failed = Result->MeasuresMachineCode
+                    ? addPassesToMeasureSize(*Result->TM, Result->PM,
+                                             Result->Sizes, HashBlocks)
+                    : Result->TM->addPassesToEmitFile(
+                          Result->PM, Result->OS, TargetMachine::CGFT_ObjectFile);
+  if (Failed) {
     DEBUG(dbgs() << "Can't initialize pass manager\n");
-    return;
+    return nullptr;
   }
+  return Result;
+}
 
-  IsInitialized = true;
+namespace {
+using PipelineList = std::vector<std::unique_ptr<CodeGenPipeline>>;
+} // end anonymous namespace
+
+static ManagedStatic<sys::SmartMutex<true>> PipelinesLock;
+/// Unused pipelines, grouped by their keys
+static ManagedStatic<StringMap<PipelineList>> Pipelines;
+
+static std::unique_ptr<CodeGenPipeline>
+acquirePipeline(const std::string &TripleName, const std::string &CPU,
+                const std::string &Features) {
+  {
+    sys::SmartScopedLock<true> Lock(*PipelinesLock);
+    auto Found =
+        Pipelines->find(CodeGenPipeline::getKey(TripleName, CPU, Features));
+    if (Found != Pipelines->end() && !Found->second.empty()) {
+      std::unique_ptr<CodeGenPipeline> Result = std::move(Found->second.back());
+      Found->second.pop_back();
+      return Result;
+    }
+  }
+  // pipeline is created without lock; creation is the expensive part
+  return CodeGenPipeline::create(TripleName, CPU, Features);
 }
 
-static void deinitializeAdditionInfo() {
-  // TODO: ? we should memorize anyhow all already initialized targets/MCs
-  // and deinitialize only targets, that were not initialized till this pass
+static void releasePipeline(std::unique_ptr<CodeGenPipeline> Pipeline) {
+  if (!Pipeline)
+    return;
+  sys::SmartScopedLock<true> Lock(*PipelinesLock);
+  (*Pipelines)[Pipeline->getKey()].push_back(std::move(Pipeline));
+}
+
+////////// Code generation pipelines cache end //////////
+
+static void copyModuleInfo(const Module &From, Module &To) {
+  To.setTargetTriple(From.getTargetTriple());
+  To.setDataLayout(From.getDataLayout());
+  To.setPICLevel(From.getPICLevel());
+  To.setPIELevel(From.getPIELevel());
+}
+
+FunctionCompiler::FunctionCompiler(const Module &OtherM)
+    : M(make_unique<Module>("FunctionCost_auxiliary", OtherM.getContext())),
+      Materializer(make_unique<ModuleMaterializer>(*M)), IsInitialized(false) {
+
+  std::string TripleName =
+      OtherM.getTargetTriple().empty()
+          ? Triple::normalize(sys::getDefaultTargetTriple())
+          : Triple::normalize(OtherM.getTargetTriple());
+
+  copyModuleInfo(OtherM, *M);
+  M->setTargetTriple(TripleName);
+  // initialize copying info
+  Mapper = make_unique<ValueMapper>(VtoV, RF_NullMapMissingGlobalValues,
+                                    nullptr, Materializer.get());
+
+  // initialize compiling info
+  std::string CPUStr;      // = getCPUStr();
+  std::string FeaturesStr; // = getFeaturesStr();
+
+  Pipeline = acquirePipeline(TripleName, CPUStr, FeaturesStr);
+  if (!Pipeline)
+    return;
+
+  M->setDataLayout(Pipeline->getTargetMachine().createDataLayout());
+  if (CodegenThreads > 1)
+    CodegenPool = make_unique<ThreadPool>(CodegenThreads);
+
+  IsInitialized = true;
 }
 
 static void getFunctionReplaces(Function &F, Function &NewF,
@@ -213,7 +416,13 @@ llvm::Function *FunctionCompiler::cloneInnerFunction(llvm::Function &F,
   return NewFunction;
 }
 
-FunctionCompiler::~FunctionCompiler() { deinitializeAdditionInfo(); }
+FunctionCompiler::~FunctionCompiler() {
+  // parts are compiled by pipelines from the cache
+  CodegenPool.reset();
+  // object file refers to the buffer of pipeline
+  Obj.reset();
+  releasePipeline(std::move(Pipeline));
+}
 
 // \p M is for debug and catching errors
 static void eraseSurroundings(Value &V, Module *M = nullptr) {
@@ -261,8 +470,22 @@ void FunctionCompiler::clearModule() {
 }
 
 bool FunctionCompiler::compile() {
-  PM.run(*M);
-  auto Buf = MemoryBufferRef(StringRef(OSBuf.data(), OSBuf.size()), "");
+  // the previous object refers to the buffer, which is going to be rewritten
+  Obj.reset();
+  IsSplit = false;
+  if (CodegenPool) {
+    size_t Defined = count_if(*M, [](const Function &F) {
+      return !F.isDeclaration();
+    });
+    if (Defined >= CodegenSplitMin)
+      return compileSplit();
+  }
+
+  StringRef Emitted = Pipeline->emit(*M);
+  if (Pipeline->measuresMachineCode())
+    return true;
+
+  auto Buf = MemoryBufferRef(Emitted, "");
   auto ExpectedObject = object::ObjectFile::createObjectFile(Buf);
   if (!ExpectedObject) {
     DEBUG(dbgs() << "Error: could not create an object file\n");
@@ -273,6 +496,163 @@ bool FunctionCompiler::compile() {
   return true;
 }
 
+bool FunctionCompiler::compileMachineBlocks(
+    std::vector<MachineBlockCode> &Blocks) {
+  // blocks are hashed once per module, so the pipeline isn't cached
+  std::unique_ptr<CodeGenPipeline> Hashing = CodeGenPipeline::create(
+      M->getTargetTriple(), "", "", /*HashBlocks=*/true);
+  if (!Hashing)
+    return false;
+  Hashing->emit(*M);
+  Blocks = Hashing->getSizes().Blocks;
+  return true;
+}
+
+namespace {
+/// Sizes of a part of the module. Its unwind info is measured without CIEs,
+/// which every object file has
+struct PartSizes {
+  MachineCodeSizes Sizes;
+  size_t CIE = 0;
+  bool Compiled = false;
+};
+} // end anonymous namespace
+
+/// Compiles part of the module, written as \p Bitcode, in its own context
+/// with a pipeline from the cache
+static void compilePart(StringRef Bitcode, const std::string &TripleName,
+                        PartSizes &Result) {
+  LLVMContext Context;
+  auto Part = parseBitcodeFile(MemoryBufferRef(Bitcode, "part"), Context);
+  if (!Part) {
+    consumeError(Part.takeError());
+    return;
+  }
+  std::unique_ptr<CodeGenPipeline> PartPipeline =
+      acquirePipeline(TripleName, "", "");
+  if (!PartPipeline)
+    return;
+
+  StringRef Emitted = PartPipeline->emit(**Part);
+  if (PartPipeline->measuresMachineCode()) {
+    Result.Sizes.Functions = PartPipeline->getSizes().Functions;
+    Result.Sizes.EH = PartPipeline->getSizes().EH;
+    Result.Compiled = true;
+  } else {
+    auto Obj =
+        object::ObjectFile::createObjectFile(MemoryBufferRef(Emitted, ""));
+    if (Obj) {
+      SmallVector<StringRef, 8> Names;
+      for (const Function &F : **Part)
+        if (!F.isDeclaration())
+          Names.push_back(F.getName());
+      auto Sizes = utilities::getFunctionSizes(**Obj, Names);
+      for (size_t i = 0, ie = Names.size(); i < ie; ++i)
+        Result.Sizes.Functions[Names[i]] = Sizes[i];
+      Result.CIE = utilities::getCIESize(**Obj);
+      Result.Sizes.EH = utilities::getEHSize(**Obj) - Result.CIE;
+      Result.Compiled = true;
+    } else {
+      consumeError(Obj.takeError());
+    }
+  }
+  releasePipeline(std::move(PartPipeline));
+}
+
+bool FunctionCompiler::compileSplit() {
+  // contexts aren't shared between threads, so parts are passed as bitcode.
+  // Local values stay in the part of their users and keep their names
+  std::vector<SmallString<0>> Parts;
+  SplitModule(CloneModule(M.get()), CodegenThreads,
+              [&Parts](std::unique_ptr<Module> Part) {
+                Parts.emplace_back();
+                raw_svector_ostream OS(Parts.back());
+                WriteBitcodeToFile(Part.get(), OS);
+              },
+              /*PreserveLocals=*/true);
+
+  std::vector<PartSizes> Results(Parts.size());
+  std::string TripleName = M->getTargetTriple();
+  for (size_t i = 0, ie = Parts.size(); i < ie; ++i) {
+    StringRef Bitcode = Parts[i];
+    PartSizes &Result = Results[i];
+    CodegenPool->async([Bitcode, &TripleName, &Result]() {
+      compilePart(Bitcode, TripleName, Result);
+    });
+  }
+  CodegenPool->wait();
+
+  SplitSizes.clear();
+  size_t CIE = 0;
+  for (const PartSizes &Result : Results) {
+    if (!Result.Compiled) {
+      DEBUG(dbgs() << "Error: part of the module was not compiled\n");
+      return false;
+    }
+    for (const auto &Size : Result.Sizes.Functions)
+      SplitSizes.Functions[Size.getKey()] = Size.getValue();
+    SplitSizes.EH += Result.Sizes.EH;
+    // the whole module would have CIEs of the part with most personalities
+    CIE = std::max(CIE, Result.CIE);
+  }
+  SplitSizes.EH += CIE;
+  IsSplit = true;
+  return true;
+}
+
+const MachineCodeSizes *FunctionCompiler::getMeasuredSizes() const {
+  if (IsSplit)
+    return &SplitSizes;
+  if (Pipeline->measuresMachineCode())
+    return &Pipeline->getSizes();
+  return nullptr;
+}
+
+SmallVector<size_t, 8>
+FunctionCompiler::getFunctionSizes(const SmallVectorImpl<StringRef> &Fs) const {
+  const MachineCodeSizes *Measured = getMeasuredSizes();
+  if (!Measured)
+    return utilities::getFunctionSizes(*Obj, Fs);
+
+  const StringMap<size_t> &Sizes = Measured->Functions;
+  SmallVector<size_t, 8> Result;
+  for (StringRef Name : Fs) {
+    auto Found = Sizes.find(Name);
+    assert(Found != Sizes.end() && "Function is not presented in module");
+    Result.push_back(Found->second);
+  }
+  return Result;
+}
+
+size_t FunctionCompiler::getEHSize() const {
+  const MachineCodeSizes *Measured = getMeasuredSizes();
+  if (!Measured)
+    return utilities::getEHSize(*Obj);
+  return Measured->EH;
+}
+
+static const TargetLowering &getTargetLowering(TargetMachine &TM,
+                                              const Function &F) {
+  return *TM.getSubtargetImpl(F)->getTargetLowering();
+}
+
+unsigned FunctionCompiler::getFunctionAlignment(const Function &F) const {
+  const TargetLowering &TLI =
+      getTargetLowering(Pipeline->getTargetMachine(), F);
+  // the same rules as MachineFunction uses, alignments are in log2 form
+  unsigned Log2Align = TLI.getMinFunctionAlignment();
+  if (!F.hasFnAttribute(Attribute::OptimizeForSize))
+    Log2Align = std::max(Log2Align, TLI.getPrefFunctionAlignment());
+  return std::max(1u << Log2Align, F.getAlignment());
+}
+
+unsigned FunctionCompiler::getPrefFunctionAlignment(const Function &F) const {
+  const TargetLowering &TLI =
+      getTargetLowering(Pipeline->getTargetMachine(), F);
+  return 1u << std::max(TLI.getMinFunctionAlignment(),
+                        TLI.getPrefFunctionAlignment());
+}
+
 llvm::Value *FunctionCompiler::getInnerModuleValue(llvm::Value &V) {
   return Mapper->mapValue(V);
 }
\ No newline at end of file
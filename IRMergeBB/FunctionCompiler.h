@@ -16,15 +16,20 @@
 #ifndef LLVMTRANSFORM_IDECISIONMAKER_H
 #define LLVMTRANSFORM_IDECISIONMAKER_H
 
+#include "MachineCodeSize.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Transforms/Utils/ValueMapper.h" // typedef ValueToValueMapTy
 #include <memory>
+#include <vector>
 
 class ModuleMaterializer;
+class CodeGenPipeline;
 namespace llvm {
+class ThreadPool;
 namespace object {
 class ObjectFile;
 }
@@ -42,11 +47,16 @@ public:
     return *M;
   }
 
-  // returns true, if succeeded
+  // returns true, if succeeded. Large modules are split into parts, which
+  // are compiled concurrently (-mergebb-codegen-threads)
   bool compile();
 
   void clearModule();
 
+  // compiles the inner module with a separate pipeline, which hashes code of
+  // every machine basic block into \p Blocks. Returns true, if succeeded
+  bool compileMachineBlocks(std::vector<MachineBlockCode> &Blocks);
+
   ~FunctionCompiler();
 
   llvm::Function *cloneFunctionToInnerModule(llvm::Function &F,
@@ -57,21 +67,49 @@ public:
 
   llvm::Value *getInnerModuleValue(llvm::Value &V);
 
-  const llvm::object::ObjectFile &getObject() const { return *Obj; }
+  // object file of the last compilation. It isn't created, when sizes are
+  // measured from machine code (-mergebb-mc-size) or module is compiled in
+  // parts
+  const llvm::object::ObjectFile &getObject() const {
+    assert(Obj && "Object file was not emitted");
+    return *Obj;
+  }
+
+  // returns sizes of functions \p Fs from the last compilation
+  llvm::SmallVector<size_t, 8>
+  getFunctionSizes(const llvm::SmallVectorImpl<llvm::StringRef> &Fs) const;
+
+  // returns size of unwind info from the last compilation
+  size_t getEHSize() const;
+
+  // returns alignment in bytes, that code generator gives to function \p F
+  unsigned getFunctionAlignment(const llvm::Function &F) const;
+
+  // returns preferred function alignment of the target for \p F in bytes
+  unsigned getPrefFunctionAlignment(const llvm::Function &F) const;
 
 private:
+  // compiles parts of the module concurrently and combines their sizes
+  bool compileSplit();
+
+  // returns sizes of the last compilation, if they weren't taken from object
+  // file of the whole module
+  const MachineCodeSizes *getMeasuredSizes() const;
+
   std::unique_ptr<llvm::Module> M;
   // utilities for partial module cloning
   llvm::ValueToValueMapTy VtoV;
   std::unique_ptr<ModuleMaterializer> Materializer;
   std::unique_ptr<llvm::ValueMapper> Mapper;
 
-  // utilities for compiling module
-  llvm::legacy::PassManager PM;
-  std::unique_ptr<llvm::TargetMachine> TM;
-  llvm::raw_svector_ostream OS;
-  llvm::SmallVector<char, 1024> OSBuf;
+  // utilities for compiling module. Pipeline is taken from the process-wide
+  // cache and is returned back, when FunctionCompiler is destroyed
+  std::unique_ptr<CodeGenPipeline> Pipeline;
   std::unique_ptr<llvm::object::ObjectFile> Obj;
+  // threads and sizes of the last compilation in parts
+  std::unique_ptr<llvm::ThreadPool> CodegenPool;
+  MachineCodeSizes SplitSizes;
+  bool IsSplit = false;
 
   bool IsInitialized;
 };
@@ -0,0 +1,578 @@
+//===-- MachineCodeSize.cpp - Measures machine code size ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Code generation pipeline is the same as in addPassesToEmitFile, but
+/// AsmPrinter emits into the streamer, that only measures: every instruction
+/// is encoded with the target code emitter and call frame information of
+/// a function is measured as DWARF CFA instructions of its FDE.
+/// Size of a function is computed by its layout like MCAssembler does it:
+/// alignment padding is counted from the start of the function, which is
+/// aligned at least as its blocks, and branches, which the target relaxes
+/// during MC layout (e.g. x86), are relaxed, while their displacement
+/// doesn't fit into the fixup. Call frame information and hashes of blocks
+/// use offsets before the layout.
+/// Blocks are hashed between labels, which are inserted right before
+/// AsmPrinter at the start of every machine basic block and before its
+/// terminators. Prologues and epilogues are hashed as code of their blocks.
+///
+//===----------------------------------------------------------------------===//
+
+#include "MachineCodeSize.h"
+#include "SiteProfile.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/CodeGen/AsmPrinter.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/Passes.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCDwarf.h"
+#include "llvm/MC/MCExpr.h"
+#include "llvm/MC/MCFixupKindInfo.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCSection.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetInstrInfo.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetSubtargetInfo.h"
+
+#define DEBUG_TYPE "functioncost"
+
+using namespace llvm;
+
+namespace {
+
+/// Streamer, that emits nothing, but measures code of every function
+class SizeStreamer : public MCStreamer {
+public:
+  /// \p Backend relaxes branches. They aren't relaxed without it
+  SizeStreamer(MCContext &Context, std::unique_ptr<MCCodeEmitter> Emitter,
+               std::unique_ptr<MCAsmBackend> Backend)
+      : MCStreamer(Context), Emitter(std::move(Emitter)),
+        Backend(std::move(Backend)) {}
+
+  /// \return size of code, emitted since the previous call, after layout
+  size_t takeCodeSize() {
+    size_t Result = layoutFunction();
+    Layout.clear();
+    LabelItems.clear();
+    CodeSize = 0;
+    LabelOffsets.clear();
+    BlockMarks.clear();
+    CurrentBlock = NoBlock;
+    return Result;
+  }
+
+  /// Code between labels \p Begin and \p End is hashed into \p Index
+  /// element of \p Blocks
+  void markBlock(const MCSymbol *Begin, const MCSymbol *End, size_t Index,
+                 std::vector<MachineBlockCode> &Blocks) {
+    HashedBlocks = &Blocks;
+    BlockMarks[Begin] = {Index, true};
+    BlockMarks[End] = {Index, false};
+  }
+
+  /// \return size of FDEs, emitted since the previous call
+  size_t takeEHSize() {
+    size_t Result = EHSize;
+    EHSize = 0;
+    return Result;
+  }
+
+  void EmitInstruction(const MCInst &Inst,
+                       const MCSubtargetInfo &STI) override {
+    MCStreamer::EmitInstruction(Inst, STI);
+    Encoded.clear();
+    Fixups.clear();
+    raw_svector_ostream OS(Encoded);
+    Emitter->encodeInstruction(Inst, OS, Fixups, STI);
+    CodeSize += Encoded.size();
+    addInstruction(Inst, STI);
+    if (!isHashing())
+      return;
+    BlockHash = hash_combine(BlockHash,
+                             hash_combine_range(Encoded.begin(), Encoded.end()));
+    // relocated bytes are equal only with the same relocation
+    for (const MCFixup &Fixup : Fixups)
+      BlockHash = hash_combine(BlockHash, Fixup.getOffset(),
+                               static_cast<unsigned>(Fixup.getKind()),
+                               hashExpr(*Fixup.getValue()));
+  }
+
+  void EmitLabel(MCSymbol *Symbol, SMLoc Loc) override;
+
+  // data inside of functions, e.g. constant islands
+  void EmitBytes(StringRef Data) override {
+    if (!isInText())
+      return;
+    CodeSize += Data.size();
+    addCode(Data.size());
+    if (isHashing())
+      BlockHash = hash_combine(BlockHash, Data);
+  }
+
+  void EmitValueImpl(const MCExpr *Value, unsigned Size, SMLoc Loc) override {
+    MCStreamer::EmitValueImpl(Value, Size, Loc);
+    if (!isInText())
+      return;
+    CodeSize += Size;
+    addCode(Size);
+    if (isHashing())
+      BlockHash = hash_combine(BlockHash, Size, hashExpr(*Value));
+  }
+
+  // alignment of loops and blocks
+  void EmitCodeAlignment(unsigned ByteAlignment,
+                         unsigned MaxBytesToEmit = 0) override {
+    addAlignment(ByteAlignment, MaxBytesToEmit);
+  }
+
+  void EmitValueToAlignment(unsigned ByteAlignment, int64_t Value = 0,
+                            unsigned ValueSize = 1,
+                            unsigned MaxBytesToEmit = 0) override {
+    addAlignment(ByteAlignment, MaxBytesToEmit);
+  }
+
+  void EmitCFIStartProcImpl(MCDwarfFrameInfo &Frame) override {
+    MCStreamer::EmitCFIStartProcImpl(Frame);
+    FrameStart = CodeSize;
+  }
+
+  void EmitCFIEndProcImpl(MCDwarfFrameInfo &Frame) override;
+
+  // the rest of interface does nothing like MCNullStreamer
+  bool EmitSymbolAttribute(MCSymbol *Symbol,
+                           MCSymbolAttr Attribute) override {
+    return true;
+  }
+  void EmitCommonSymbol(MCSymbol *Symbol, uint64_t Size,
+                        unsigned ByteAlignment) override {}
+  void EmitZerofill(MCSection *Section, MCSymbol *Symbol = nullptr,
+                    uint64_t Size = 0, unsigned ByteAlignment = 0) override {}
+  void EmitGPRel32Value(const MCExpr *Value) override {}
+  void BeginCOFFSymbolDef(const MCSymbol *Symbol) override {}
+  void EmitCOFFSymbolStorageClass(int StorageClass) override {}
+  void EmitCOFFSymbolType(int Type) override {}
+  void EndCOFFSymbolDef() override {}
+
+private:
+  bool isInText() const {
+    const MCSection *Section = getCurrentSectionOnly();
+    return Section && Section->getKind().isText();
+  }
+
+  bool isHashing() const { return CurrentBlock != NoBlock; }
+
+  /// Piece of the current function for the layout
+  struct LayoutItem {
+    enum ItemKind { Code, Alignment, Branch } Kind;
+    /// Bytes of code or of the branch, maximum padding of the alignment
+    size_t Size;
+    /// Alignment or size of the relaxed branch
+    size_t Param;
+    /// Branch target, addend of its fixup and position and bits of the fixup
+    const MCSymbol *Target;
+    int64_t Addend;
+    unsigned FixupOffset;
+    unsigned FixupBits;
+    size_t Offset;
+  };
+
+  void addCode(size_t Size) {
+    if (!Layout.empty() && Layout.back().Kind == LayoutItem::Code)
+      Layout.back().Size += Size;
+    else
+      Layout.push_back({LayoutItem::Code, Size, 0, nullptr, 0, 0, 0, 0});
+  }
+
+  void addAlignment(unsigned ByteAlignment, unsigned MaxBytesToEmit) {
+    if (!isInText() || ByteAlignment <= 1)
+      return;
+    size_t MaxPadding = MaxBytesToEmit ? MaxBytesToEmit : ByteAlignment;
+    Layout.push_back({LayoutItem::Alignment, MaxPadding, ByteAlignment,
+                      nullptr, 0, 0, 0, 0});
+  }
+
+  void addInstruction(const MCInst &Inst, const MCSubtargetInfo &STI);
+
+  size_t layoutFunction();
+
+  /// \return hash of printed \p Expr, i.e. of names of referenced symbols
+  hash_code hashExpr(const MCExpr &Expr) {
+    std::string Printed;
+    raw_string_ostream OS(Printed);
+    Expr.print(OS, getContext().getAsmInfo());
+    return hash_value(OS.str());
+  }
+
+  std::unique_ptr<MCCodeEmitter> Emitter;
+  std::unique_ptr<MCAsmBackend> Backend;
+  SmallVector<char, 16> Encoded;
+  SmallVector<MCFixup, 4> Fixups;
+
+  size_t CodeSize = 0;
+  size_t EHSize = 0;
+  size_t FrameStart = 0;
+  /// Offsets of labels inside of the current function
+  DenseMap<const MCSymbol *, size_t> LabelOffsets;
+  /// Layout of the current function and labels by items, they precede
+  std::vector<LayoutItem> Layout;
+  DenseMap<const MCSymbol *, size_t> LabelItems;
+
+  static const size_t NoBlock = ~size_t(0);
+  /// Labels, which start (true) or end (false) hashed blocks, by indices of
+  /// the blocks in HashedBlocks
+  DenseMap<const MCSymbol *, std::pair<size_t, bool>> BlockMarks;
+  std::vector<MachineBlockCode> *HashedBlocks = nullptr;
+  size_t CurrentBlock = NoBlock;
+  size_t BlockStart = 0;
+  hash_code BlockHash = 0;
+};
+
+} // end anonymous namespace
+
+/// \return symbol of \p Expr, which is a symbol or a symbol plus constant,
+/// written into \p Addend
+static const MCSymbol *getBranchTarget(const MCExpr &Expr, int64_t &Addend) {
+  Addend = 0;
+  const MCExpr *Symbol = &Expr;
+  if (auto *Binary = dyn_cast<MCBinaryExpr>(&Expr)) {
+    auto *Constant = dyn_cast<MCConstantExpr>(Binary->getRHS());
+    if (Binary->getOpcode() != MCBinaryExpr::Add || !Constant)
+      return nullptr;
+    Addend = Constant->getValue();
+    Symbol = Binary->getLHS();
+  }
+  auto *Ref = dyn_cast<MCSymbolRefExpr>(Symbol);
+  if (!Ref || Ref->getKind() != MCSymbolRefExpr::VK_None)
+    return nullptr;
+  return &Ref->getSymbol();
+}
+
+void SizeStreamer::addInstruction(const MCInst &Inst,
+                                  const MCSubtargetInfo &STI) {
+  if (!Backend || Fixups.size() != 1 || !Backend->mayNeedRelaxation(Inst)) {
+    addCode(Encoded.size());
+    return;
+  }
+
+  MCInst Relaxed;
+  Backend->relaxInstruction(Inst, STI, Relaxed);
+  SmallVector<char, 16> RelaxedCode;
+  SmallVector<MCFixup, 4> RelaxedFixups;
+  raw_svector_ostream OS(RelaxedCode);
+  Emitter->encodeInstruction(Relaxed, OS, RelaxedFixups, STI);
+
+  const MCFixup &Fixup = Fixups.front();
+  const MCFixupKindInfo &Info = Backend->getFixupKindInfo(Fixup.getKind());
+  LayoutItem Item = {LayoutItem::Branch, Encoded.size(), RelaxedCode.size(),
+                     nullptr, 0, Fixup.getOffset(), Info.TargetSize, 0};
+  Item.Target = getBranchTarget(*Fixup.getValue(), Item.Addend);
+  // the assembler relaxes fixups, which it can't resolve
+  if (!Item.Target || !(Info.Flags & MCFixupKindInfo::FKF_IsPCRel)) {
+    addCode(Item.Param);
+    return;
+  }
+  Layout.push_back(Item);
+}
+
+size_t SizeStreamer::layoutFunction() {
+  size_t Size;
+  bool Relaxed;
+  // branches only grow, so the layout converges
+  do {
+    Size = 0;
+    for (LayoutItem &Item : Layout) {
+      Item.Offset = Size;
+      if (Item.Kind != LayoutItem::Alignment) {
+        Size += Item.Size;
+        continue;
+      }
+      size_t Padding = alignTo(Size, Item.Param) - Size;
+      if (Padding <= Item.Size)
+        Size += Padding;
+    }
+
+    Relaxed = false;
+    for (LayoutItem &Item : Layout) {
+      if (Item.Kind != LayoutItem::Branch || Item.Size == Item.Param)
+        continue;
+      auto Label = LabelItems.find(Item.Target);
+      bool Fits = false;
+      if (Label != LabelItems.end()) {
+        size_t Target = Label->second < Layout.size()
+                            ? Layout[Label->second].Offset
+                            : Size;
+        int64_t Value = static_cast<int64_t>(Target) + Item.Addend -
+                        static_cast<int64_t>(Item.Offset + Item.FixupOffset);
+        Fits = isIntN(Item.FixupBits, Value);
+      }
+      if (!Fits) {
+        Item.Size = Item.Param;
+        Relaxed = true;
+      }
+    }
+  } while (Relaxed);
+  return Size;
+}
+
+void SizeStreamer::EmitLabel(MCSymbol *Symbol, SMLoc Loc) {
+  MCStreamer::EmitLabel(Symbol, Loc);
+  LabelOffsets[Symbol] = CodeSize;
+  if (isInText()) {
+    // label starts a new item, so it keeps its place in the layout
+    Layout.push_back({LayoutItem::Code, 0, 0, nullptr, 0, 0, 0, 0});
+    LabelItems[Symbol] = Layout.size() - 1;
+  }
+
+  auto Mark = BlockMarks.find(Symbol);
+  if (Mark == BlockMarks.end())
+    return;
+  size_t Index = Mark->second.first;
+  if (Mark->second.second) {
+    CurrentBlock = Index;
+    BlockStart = CodeSize;
+    BlockHash = 0;
+  } else if (CurrentBlock == Index) {
+    MachineBlockCode &Code = (*HashedBlocks)[Index];
+    Code.Size = CodeSize - BlockStart;
+    Code.Hash = BlockHash;
+    CurrentBlock = NoBlock;
+  }
+}
+
+/// \return size of DW_CFA_advance_loc* for \p Delta
+static size_t getAdvanceLocSize(uint64_t Delta) {
+  if (Delta == 0)
+    return 0;
+  if (isUInt<6>(Delta))
+    return 1;
+  if (isUInt<8>(Delta))
+    return 2;
+  if (isUInt<16>(Delta))
+    return 3;
+  return 5;
+}
+
+/// \return size of \p Instr, encoded the same way as MCDwarf does it
+static size_t getCFIInstructionSize(const MCCFIInstruction &Instr,
+                                    int64_t &CFAOffset, int DataAlign) {
+  unsigned Reg = Instr.getRegister();
+  switch (Instr.getOperation()) {
+  case MCCFIInstruction::OpDefCfa:
+    CFAOffset = -Instr.getOffset();
+    return 1 + getULEB128Size(Reg) + getULEB128Size(CFAOffset);
+  case MCCFIInstruction::OpDefCfaOffset:
+    CFAOffset = -Instr.getOffset();
+    return 1 + getULEB128Size(CFAOffset);
+  case MCCFIInstruction::OpAdjustCfaOffset:
+    CFAOffset += Instr.getOffset();
+    return 1 + getULEB128Size(CFAOffset);
+  case MCCFIInstruction::OpDefCfaRegister:
+  case MCCFIInstruction::OpSameValue:
+  case MCCFIInstruction::OpUndefined:
+    return 1 + getULEB128Size(Reg);
+  case MCCFIInstruction::OpOffset:
+  case MCCFIInstruction::OpRelOffset: {
+    int64_t Offset = Instr.getOffset();
+    if (Instr.getOperation() == MCCFIInstruction::OpRelOffset)
+      Offset -= CFAOffset;
+    Offset /= DataAlign;
+    if (Offset < 0)
+      return 1 + getULEB128Size(Reg) + getSLEB128Size(Offset);
+    if (Reg < 64)
+      return 1 + getULEB128Size(Offset);
+    return 1 + getULEB128Size(Reg) + getULEB128Size(Offset);
+  }
+  case MCCFIInstruction::OpRestore:
+    return Reg < 64 ? 1 : 1 + getULEB128Size(Reg);
+  case MCCFIInstruction::OpRegister:
+    return 1 + getULEB128Size(Reg) + getULEB128Size(Instr.getRegister2());
+  case MCCFIInstruction::OpGnuArgsSize:
+    return 1 + getULEB128Size(Instr.getOffset());
+  case MCCFIInstruction::OpEscape:
+    return Instr.getValues().size();
+  case MCCFIInstruction::OpRememberState:
+  case MCCFIInstruction::OpRestoreState:
+  case MCCFIInstruction::OpWindowSave:
+    return 1;
+  }
+  llvm_unreachable("Unknown CFI instruction");
+}
+
+void SizeStreamer::EmitCFIEndProcImpl(MCDwarfFrameInfo &Frame) {
+  MCStreamer::EmitCFIEndProcImpl(Frame);
+
+  const MCAsmInfo &MAI = *getContext().getAsmInfo();
+  int DataAlign = static_cast<int>(MAI.getCalleeSaveStackSlotSize()) *
+                  (MAI.isStackGrowthDirectionUp() ? 1 : -1);
+  unsigned CodeAlign = std::max(MAI.getMinInstAlignment(), 1u);
+
+  // length, CIE pointer, initial location and address range
+  size_t Size = 4 * 4;
+  // augmentation data: its length and LSDA pointer
+  Size += 1 + (Frame.Lsda ? 4 : 0);
+
+  size_t Loc = FrameStart;
+  int64_t CFAOffset = 0;
+  for (const MCCFIInstruction &Instr : Frame.Instructions) {
+    auto Found = LabelOffsets.find(Instr.getLabel());
+    if (Found != LabelOffsets.end() && Found->second > Loc) {
+      Size += getAdvanceLocSize((Found->second - Loc) / CodeAlign);
+      Loc = Found->second;
+    }
+    Size += getCFIInstructionSize(Instr, CFAOffset, DataAlign);
+  }
+  // FDEs are aligned to 4 bytes in .eh_frame
+  EHSize += alignTo(Size, 4);
+}
+
+namespace {
+
+/// Takes sizes, measured by SizeStreamer, when AsmPrinter has finished
+/// the function
+class SizeCollector : public FunctionPass {
+public:
+  static char ID;
+
+  SizeCollector(SizeStreamer &Streamer, MachineCodeSizes &Result)
+      : FunctionPass(ID), Streamer(Streamer), Result(Result) {}
+
+  bool runOnFunction(Function &F) override {
+    Result.Functions[F.getName()] = Streamer.takeCodeSize();
+    Result.EH += Streamer.takeEHSize();
+    return false;
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+
+  StringRef getPassName() const override {
+    return "Machine code size collector";
+  }
+
+private:
+  SizeStreamer &Streamer;
+  MachineCodeSizes &Result;
+};
+
+} // end anonymous namespace
+
+char SizeCollector::ID = 0;
+
+namespace {
+
+/// Inserts labels at the start of every machine basic block with a source
+/// IR block and before its terminators, so SizeStreamer hashes its code
+class BlockLabeler : public MachineFunctionPass {
+public:
+  static char ID;
+
+  BlockLabeler(SizeStreamer &Streamer, std::vector<MachineBlockCode> &Blocks)
+      : MachineFunctionPass(ID), Streamer(Streamer), Blocks(Blocks) {}
+
+  bool runOnMachineFunction(MachineFunction &MF) override {
+    const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+    MCContext &Context = MF.getContext();
+    for (MachineBasicBlock &MBB : MF) {
+      const BasicBlock *BB = MBB.getBasicBlock();
+      if (!BB)
+        continue;
+      MCSymbol *Begin = Context.createTempSymbol();
+      MCSymbol *End = Context.createTempSymbol();
+      // the end is inserted first, because block may consist of terminators
+      BuildMI(MBB, MBB.getFirstTerminator(), DebugLoc(),
+              TII.get(TargetOpcode::GC_LABEL))
+          .addSym(End);
+      BuildMI(MBB, MBB.begin(), DebugLoc(), TII.get(TargetOpcode::GC_LABEL))
+          .addSym(Begin);
+      Streamer.markBlock(Begin, End, Blocks.size(), Blocks);
+      Blocks.emplace_back();
+      Blocks.back().Source = getCallSiteName(*BB);
+    }
+    return true;
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+  StringRef getPassName() const override {
+    return "Machine basic block labeler";
+  }
+
+private:
+  SizeStreamer &Streamer;
+  std::vector<MachineBlockCode> &Blocks;
+};
+
+} // end anonymous namespace
+
+char BlockLabeler::ID = 0;
+
+bool addPassesToMeasureSize(TargetMachine &TM, legacy::PassManagerBase &PM,
+                            MachineCodeSizes &Result, bool HashBlocks) {
+  // the same steps as addPassesToEmitFile does, except of the streamer
+  auto &LLVMTM = static_cast<LLVMTargetMachine &>(TM);
+  TargetPassConfig *PassConfig = LLVMTM.createPassConfig(PM);
+  PassConfig->setDisableVerify(true);
+  PM.add(PassConfig);
+  MachineModuleInfo *MMI = new MachineModuleInfo(&LLVMTM);
+  PM.add(MMI);
+  if (PassConfig->addISelPasses())
+    return true;
+  PassConfig->addMachinePasses();
+  PassConfig->setInitialized();
+
+  MCContext &Context = MMI->getContext();
+  const Target &TheTarget = TM.getTarget();
+  MCCodeEmitter *Emitter = TheTarget.createMCCodeEmitter(
+      *TM.getMCInstrInfo(), *TM.getMCRegisterInfo(), Context);
+  if (!Emitter) {
+    DEBUG(dbgs() << "Target has no code emitter\n");
+    return true;
+  }
+
+  // branches aren't relaxed, if the target has no assembler backend
+  MCAsmBackend *AsmBackend = TheTarget.createMCAsmBackend(
+      *TM.getMCRegisterInfo(), TM.getTargetTriple().str(), TM.getTargetCPU(),
+      TM.Options.MCOptions);
+
+  auto Streamer = make_unique<SizeStreamer>(
+      Context, std::unique_ptr<MCCodeEmitter>(Emitter),
+      std::unique_ptr<MCAsmBackend>(AsmBackend));
+  SizeStreamer &StreamerRef = *Streamer;
+  // AsmPrinters of some targets expect target streamer
+  TheTarget.createNullTargetStreamer(*Streamer);
+
+  FunctionPass *Printer = TheTarget.createAsmPrinter(TM, std::move(Streamer));
+  if (!Printer)
+    return true;
+
+  if (HashBlocks)
+    PM.add(new BlockLabeler(StreamerRef, Result.Blocks));
+  PM.add(Printer);
+  PM.add(new SizeCollector(StreamerRef, Result));
+  PM.add(createFreeMachineFunctionPass());
+  return false;
+}
@@ -0,0 +1,66 @@
+//===-- MachineCodeSize.h - Measures machine code size ----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file contains interface to measure function sizes right after
+/// code emission without writing and parsing object files. Machine code of
+/// basic blocks may be hashed as well to find duplicates after codegen
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMTRANSFORM_MACHINECODESIZE_H
+#define LLVMTRANSFORM_MACHINECODESIZE_H
+
+#include "llvm/ADT/StringMap.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+class TargetMachine;
+namespace legacy {
+class PassManagerBase;
+}
+} // namespace llvm
+
+/// Machine code of a basic block without its terminators
+struct MachineBlockCode {
+  /// Source IR block, named the same way as getCallSiteName does
+  std::string Source;
+  /// Encoded size in bytes
+  size_t Size = 0;
+  /// Hash of encoded bytes and of expressions, which relocate them
+  uint64_t Hash = 0;
+};
+
+/// Sizes of functions, measured from machine code
+struct MachineCodeSizes {
+  /// Encoded size of every function by its name
+  llvm::StringMap<size_t> Functions;
+  /// Estimated size of .eh_frame entries of all functions
+  size_t EH = 0;
+  /// Code of every machine basic block, which has a source IR block, if
+  /// blocks are hashed
+  std::vector<MachineBlockCode> Blocks;
+
+  void clear() {
+    Functions.clear();
+    EH = 0;
+    Blocks.clear();
+  }
+};
+
+/// Adds code generation passes to \p PM, that don't emit an object file,
+/// but encode every instruction and write sizes of functions into \p Result.
+/// If \p HashBlocks is set, code of basic blocks is hashed into Result.Blocks
+/// \returns true if \p TM doesn't support it (like addPassesToEmitFile)
+bool addPassesToMeasureSize(llvm::TargetMachine &TM,
+                            llvm::legacy::PassManagerBase &PM,
+                            MachineCodeSizes &Result, bool HashBlocks = false);
+
+#endif // LLVMTRANSFORM_MACHINECODESIZE_H
@@ -22,24 +22,60 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include "MergeBB.h"
+#include "BlockSharing.h"
 #include "CompareBB.h"
 #include "FunctionCompiler.h"
+#include "MachineCodeSize.h"
+#include "Progress.h"
+#include "SimilarityIndex.h"
+#include "SiteProfile.h"
 #include "Utilities.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 
 // TODO: add partial replacing (several replaced, others not)
 // TODO: create cache for sized functions
-// TODO: solve issues with function allignment
 
 #define DEBUG_TYPE "mergebb"
 
 STATISTIC(MergeCounter, "Number of merged basic blocks");
 STATISTIC(FunctionCounter, "Amount of created functions");
+STATISTIC(ArenaPeakBytes, "Peak size of per-group analysis arena in bytes");
+STATISTIC(RoundCounter, "Number of merging rounds");
+STATISTIC(ColdFunctionCounter,
+          "Number of created functions, placed into cold section");
+STATISTIC(InvariantInputCounter,
+          "Number of inputs, computed by created functions instead of calls");
+STATISTIC(SplitGroupCounter,
+          "Number of groups, merged separately by outputs of members");
+STATISTIC(SharedCounter,
+          "Number of basic blocks, sharing a copy inside their function");
+STATISTIC(TailCounter, "Number of functions, ending in a shared tail call");
 
 using namespace llvm;
 using namespace llvm::utilities;
@@ -48,6 +84,120 @@ static cl::opt<bool>
     ForceMerge("mergebb-force", cl::Hidden, cl::init(false),
                cl::desc("Force folding basic blocks, when it is unprofitable"));
 
+static cl::opt<bool> DryRun(
+    "mergebb-dry-run", cl::Hidden, cl::init(false),
+    cl::desc("Evaluate groups of identical basic blocks and report decisions "
+             "without modifying the module"));
+
+static cl::opt<bool> FastCostOpt(
+    "mergebb-fast-cost", cl::Hidden, cl::init(false),
+    cl::desc("Estimate sizes by target costs of instructions instead of "
+             "compiling candidates. Sharing of blocks and tails, which needs "
+             "compilation, is disabled"));
+
+static cl::opt<bool> AlignCreated(
+    "mergebb-align-created", cl::Hidden, cl::init(false),
+    cl::desc("Give preferred target alignment to created functions, if "
+             "merging is profitable with their alignment padding. Otherwise "
+             "they have minimal alignment, as functions optimized for size"));
+
+static cl::opt<unsigned> RegisterArgs(
+    "mergebb-register-args", cl::Hidden, cl::init(6),
+    cl::desc("Number of arguments, passed in registers. Inputs of created "
+             "functions over this limit may be packed into a struct, passed "
+             "by pointer, if it is cheaper. 0 disables packing"));
+
+static cl::opt<bool> SplitOutputs(
+    "mergebb-split-outputs", cl::Hidden, cl::init(true),
+    cl::desc("Members of a group with different outputs may be merged into "
+             "separate functions, if it is more profitable, than the union "
+             "of outputs. Forced merging splits groups, if every variant "
+             "has at least 2 members"));
+
+static cl::opt<bool> ShareBlocks(
+    "mergebb-share", cl::Hidden, cl::init(true),
+    cl::desc("Identical blocks of the same function may branch to a single "
+             "shared copy instead of calling a created function, if it is "
+             "more profitable. Forced merging always shares them"));
+
+static cl::opt<bool> ShareTails(
+    "mergebb-share-tails", cl::Hidden, cl::init(true),
+    cl::desc("Single-block functions, ending in the same instructions, "
+             "tail call a single copy of their common tail, if it is "
+             "profitable. The stage runs after merging"));
+
+static cl::opt<unsigned> TailMinSize(
+    "mergebb-tail-min", cl::Hidden, cl::init(2),
+    cl::desc("Minimal number of instructions of a shared tail besides "
+             "return"));
+
+static cl::opt<bool> PlaceCold(
+    "mergebb-place-cold", cl::Hidden, cl::init(true),
+    cl::desc("Place created functions, called only from cold blocks, into "
+             ".text.unlikely or into -mergebb-cold-section"));
+
+static cl::opt<std::string> ColdSection(
+    "mergebb-cold-section", cl::Hidden,
+    cl::desc("Section for created functions, called only from cold blocks"));
+
+static cl::opt<std::string> SymbolOrderFile(
+    "mergebb-symbol-order", cl::Hidden, cl::value_desc("filename"),
+    cl::desc("Write symbol ordering file for lld (--symbol-ordering-file), "
+             "that places hot created functions next to their most "
+             "frequent callers"));
+
+static cl::opt<bool> Instrument(
+    "mergebb-instrument", cl::Hidden, cl::init(false),
+    cl::desc("Count executions of calls, that replace merged blocks. "
+             "Programs are linked with runtime/mergebb_rt.c, which dumps "
+             "counters at exit"));
+
+static cl::opt<std::string> SiteProfileFile(
+    "mergebb-site-profile", cl::Hidden, cl::value_desc("filename"),
+    cl::desc("Counters, dumped by an instrumented program. Blocks with hot "
+             "call sites aren't merged"));
+
+static cl::opt<unsigned> HotCalls(
+    "mergebb-hot-calls", cl::Hidden, cl::init(1000),
+    cl::desc("Minimal number of executions of a hot call site"));
+
+static cl::opt<unsigned> MaxRounds(
+    "mergebb-rounds", cl::Hidden, cl::init(1),
+    cl::desc("Maximum number of merging rounds. Every next round examines "
+             "only blocks of functions, changed by the previous one"));
+
+static cl::opt<unsigned> ProgressInterval(
+    "mergebb-progress", cl::Hidden, cl::init(0),
+    cl::desc("Report progress every N seconds, 0 disables it"));
+
+static cl::opt<unsigned> DeadlineOpt(
+    "mergebb-deadline", cl::Hidden, cl::init(0),
+    cl::desc("Stop merging after N seconds, keeping blocks, merged so far. "
+             "0 disables it"));
+
+static cl::opt<bool> CancelOnSignal(
+    "mergebb-cancel-on-signal", cl::Hidden, cl::init(false),
+    cl::desc("Stop merging on the first SIGINT or SIGTERM, keeping blocks, "
+             "merged so far"));
+
+static cl::opt<bool> ReportSimilar(
+    "mergebb-report-similar", cl::Hidden, cl::init(false),
+    cl::desc("Report clusters of similar, but not identical basic blocks"));
+
+static cl::opt<double> SimilarityThreshold(
+    "mergebb-similarity", cl::Hidden, cl::init(0.5),
+    cl::desc("Minimal estimated similarity of blocks in reported clusters"));
+
+static cl::opt<bool> ReportMachineDuplicates(
+    "mergebb-report-machine-duplicates", cl::Hidden, cl::init(false),
+    cl::desc("Report blocks with identical machine code, which aren't "
+             "merged because of different IR, and IR-identical blocks with "
+             "different machine code"));
+
+static cl::opt<unsigned> MachineDuplicateMin(
+    "mergebb-machine-duplicate-min", cl::Hidden, cl::init(8),
+    cl::desc("Minimal size of reported blocks with identical machine code"));
+
 static cl::opt<std::string> MergeSpecialFunction(
     "mergebb-function", cl::Hidden,
     cl::desc("Merge group of identical BBs,"
@@ -60,6 +210,14 @@ static cl::opt<std::string>
 
 namespace {
 
+/// Stack slots for outputs of calls by caller and callee. Calls of the same
+/// function from the same caller share slots: every slot is live only from
+/// the call to the reload of the output. Slots precede the merged part of
+/// the entry block, so they stay there, when it is merged; a handle is
+/// cleared, if the caller is deleted
+using OutputSlotMap = DenseMap<std::pair<const Function *, const Function *>,
+                               SmallVector<WeakVH, 4>>;
+
 /// MergeBB finds basic blocks which will generate identical machine code
 /// Once identified, MergeBB will fold them by replacing these basic blocks
 /// with a call to a function.
@@ -67,23 +225,118 @@ class MergeBB : public ModulePass {
 public:
   static char ID;
 
-  MergeBB() : ModulePass(ID) {}
+  MergeBB(const MergeBBOptions &Options = MergeBBOptions())
+      : ModulePass(ID), FastCost(Options.FastCost || FastCostOpt),
+        Deadline(Options.Deadline ? Options.Deadline : DeadlineOpt),
+        Cancel(Options.Cancel) {}
 
   virtual void getAnalysisUsage(AnalysisUsage &Info) const override;
 
   virtual bool runOnModule(Module &M) override;
 
 private:
+  /// Measured merging of a group and the chosen callee
+  struct MergePlan;
+
+  /// Finds or creates the callee for \p Group and measures merging with it
+  /// \returns nullptr, if the group can't be merged
+  std::unique_ptr<MergePlan>
+  measure(const SmallVectorImpl<BasicBlock *> &Group);
+
+  /// Reports \p Plan and, if it is profitable or forced, replaces its BBs
+  /// with a call of its callee
+  /// \returns whether BBs were replaced with a function call
+  bool commit(MergePlan &Plan);
+
+  /// Erases function, created by \p Plan, which isn't committed
+  void discard(MergePlan &Plan);
+
   /// If profitable, creates function with body of BB and replaces BBs
   /// with a call to new function
-  /// \param BBs - Vector of identity BBs
+  /// \param Group - Vector of identity BBs
   /// \returns whether BBs were replaced with a function call
-  bool replace(const SmallVectorImpl<BasicBlock *> &BBs);
+  bool replace(const SmallVectorImpl<BasicBlock *> &Group);
+
+  /// Splits \p Group into variants of members with the same outputs, if
+  /// merging them separately is more profitable, than merging all members
+  /// with the union of outputs. Members without a pair aren't merged then,
+  /// so the comparison counts no profit for them
+  /// \returns whether BBs were replaced
+  bool replaceGroup(const SmallVectorImpl<BasicBlock *> &Group);
+
+  /// Records frequencies of calls of created function \p Callee, that
+  /// replace \p BBInfos
+  void recordCallers(Function *Callee, ArrayRef<BBInfo> BBInfos);
+
+  /// Frequency of a block and whether it is cold by profile
+  struct BlockWeight {
+    uint64_t Weight;
+    bool Cold;
+  };
+  using BlockWeightMap = DenseMap<const BasicBlock *, BlockWeight>;
+
+  /// \return weights of all blocks of \p Caller, computed once by
+  /// BlockFrequencyInfo
+  const BlockWeightMap &getBlockWeights(Function &Caller,
+                                        ProfileSummaryInfo &PSI);
+
+  /// Moves cached weight of \p From to \p To, which replaces it in the CFG
+  void moveBlockWeight(const BasicBlock *From, const BasicBlock *To);
+
+  /// Replaces common suffixes of created and other single-block functions
+  /// with tail calls of shared tails
+  /// \returns whether any function was changed
+  bool shareTails(Module &M);
+
+  /// Places cold created functions into cold section and writes symbol
+  /// ordering file for the hot ones
+  void placeCreatedFunctions(Module &M);
 
   std::unique_ptr<FunctionNameCreator> FNamer;
   GlobalNumberState GlobalNumbers;
   std::map<std::string, size_t> CostHash;
+  /// Encodings of candidate blocks for the fast comparison
+  BBEncodingTable Encodings;
+  /// Compiles candidates for the cost model. It isn't created for the fast
+  /// estimate
   std::unique_ptr<FunctionCompiler> Cost;
+  bool FastCost;
+  /// Cancellation of merging: seconds to the deadline and the external flag
+  unsigned Deadline;
+  const std::atomic<bool> *Cancel;
+  MergeProgress Progress;
+  /// Functions, changed by the current round, including created ones
+  SetVector<Function *> ChangedFunctions;
+
+  /// Calls of a created function, collected for its placement
+  struct CallerInfo {
+    /// Caller -> frequency of calls from it
+    SmallMapVector<Function *, uint64_t, 4> Weights;
+    /// All calls are in cold blocks
+    bool Cold = true;
+  };
+  MapVector<Function *, CallerInfo> Placements;
+  /// Caller -> weights of its blocks. Replacing blocks with calls keeps the
+  /// CFG, so the weights stay valid; other changes of the CFG drop them
+  DenseMap<const Function *, BlockWeightMap> BlockWeights;
+  /// Output slots of calls of created functions
+  OutputSlotMap OutputSlots;
+  /// Counters of calls (-mergebb-instrument)
+  CallSiteCounters SiteCounters;
+  /// Executions of calls of the instrumented run (-mergebb-site-profile)
+  CallSiteProfile SiteProfile;
+
+  /// Memory for analysis of the current group. It is reset between groups
+  GroupArena Arena;
+  TimerGroup Timers{"mergebb", "MergeBB"};
+  Timer AnalysisTimer{"analysis", "Per-group analysis", Timers};
+
+  /// Summary of decisions, printed in dry run mode and by progress reports
+  struct DryRunReport {
+    size_t Groups = 0;
+    size_t Profitable = 0;
+    int64_t Profit = 0;
+  } Report;
 };
 
 } // end anonymous namespace
@@ -91,11 +344,209 @@ private:
 char MergeBB::ID = 0;
 static RegisterPass<MergeBB> X("mergebb", "Merge basic blocks", false, false);
 
+ModulePass *llvm::createMergeBBPass() { return new MergeBB(); }
+
+ModulePass *llvm::createMergeBBPass(const MergeBBOptions &Options) {
+  return new MergeBB(Options);
+}
+
+bool llvm::mergeBasicBlocks(Module &M, TargetMachine *TM,
+                            const MergeBBOptions &Options) {
+  // analyses, required by the pass, are created by pass manager
+  initializeAnalysis(*PassRegistry::getPassRegistry());
+  legacy::PassManager PM;
+  PM.add(createTargetTransformInfoWrapperPass(
+      TM ? TM->getTargetIRAnalysis() : TargetIRAnalysis()));
+  PM.add(createMergeBBPass(Options));
+  return PM.run(M);
+}
+
 void MergeBB::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<TargetTransformInfoWrapperPass>();
+  AU.addRequired<ProfileSummaryInfoWrapperPass>();
+  AU.addRequired<BlockFrequencyInfoWrapperPass>();
+}
+
+/// Replaces \p Nodes with fingerprints of mergeable blocks of \p F
+static void fingerprintFunction(Function &F, std::vector<BBNode> &Nodes,
+                                BBEncodingTable &Encodings) {
+  Nodes.clear();
+  for (auto &BB : F.getBasicBlockList())
+    if (!skipFromMerging(&BB))
+      Nodes.emplace_back(&BB, Encodings);
 }
 
-static bool skipFromMerging(const BasicBlock *BB);
+using FingerprintMap = MapVector<Function *, std::vector<BBNode>>;
+
+/// Reports clusters of near-duplicate blocks. Clusters, which blocks might be
+/// identical, are skipped because they are handled by merging
+static void reportSimilarBlocks(const FingerprintMap &Fingerprints,
+                                const BBEncodingTable &Encodings) {
+  SimilarityIndex Index;
+  std::vector<const BBNode *> Nodes;
+  for (const auto &FuncNodes : Fingerprints) {
+    for (const auto &Node : FuncNodes.second) {
+      Index.insert(*Node.getBB());
+      Nodes.push_back(&Node);
+    }
+  }
+
+  size_t Reported = 0;
+  for (const auto &Cluster : Index.getClusters(SimilarityThreshold)) {
+    const BBNode *First = Nodes[Cluster.front()];
+    bool AllEqual = all_of(Cluster, [&](SimilarityIndex::BlockId Id) {
+      return Encodings.compare(First->getEncoding(),
+                               Nodes[Id]->getEncoding()) == 0;
+    });
+    if (AllEqual)
+      continue;
+
+    double MinSimilarity = 1.0;
+    for (SimilarityIndex::BlockId Id : Cluster)
+      MinSimilarity =
+          std::min(MinSimilarity, Index.getSimilarity(Cluster.front(), Id));
+
+    BasicBlock *BB = First->getBB();
+    OptimizationRemarkEmitter ORE(BB->getParent(), nullptr);
+    OptimizationRemarkAnalysis Similar(DEBUG_TYPE, "SimilarBlocks",
+                                       &*getBeginIt(BB));
+    Similar << "cluster of " << ore::NV("Members", Cluster.size())
+            << " similar blocks with estimated similarity "
+            << ore::NV("Similarity", static_cast<unsigned>(MinSimilarity * 100))
+            << "%;";
+    for (SimilarityIndex::BlockId Id : Cluster) {
+      const BasicBlock *Member = Index.getBlock(Id);
+      Similar << " " << ore::NV("Function", Member->getParent()->getName())
+              << ":" << ore::NV("Block", Member->getName());
+    }
+    ORE.emit(Similar);
+    ++Reported;
+  }
+
+  errs() << "MergeBB similar blocks: " << Reported << " clusters of "
+         << Index.size() << " candidate blocks\n";
+}
+
+/// Adds " function:block" of \p BB to \p Remark
+static void addBlockName(OptimizationRemarkAnalysis &Remark,
+                         const BasicBlock &BB) {
+  Remark << " " << ore::NV("Function", BB.getParent()->getName()) << ":"
+         << ore::NV("Block", BB.getName());
+}
+
+/// Compiles the whole module and compares machine code of its blocks with
+/// groups of identical IR blocks. Reports blocks with identical machine code,
+/// which merging doesn't deduplicate, because they differ in IR or aren't
+/// candidates, and IR-identical blocks, which are compiled differently
+static void reportMachineDuplicates(Module &M, FunctionCompiler &Cost,
+                                    const FingerprintMap &Fingerprints,
+                                    const BBNodeCmp &Cmp) {
+  // identical candidates get the same IR group, the rest are in none
+  std::map<BBNode, unsigned, BBNodeCmp> IRGroups(Cmp);
+  DenseMap<const BasicBlock *, unsigned> IRGroupOf;
+  for (const auto &FuncNodes : Fingerprints) {
+    for (const auto &Node : FuncNodes.second) {
+      auto Inserted =
+          IRGroups.insert({Node, static_cast<unsigned>(IRGroups.size())});
+      IRGroupOf[Node.getBB()] = Inserted.first->second;
+    }
+  }
+
+  // cloned functions and blocks keep their names
+  StringMap<const BasicBlock *> Sources;
+  for (Function &F : M) {
+    if (F.isDeclaration() || F.hasAvailableExternallyLinkage())
+      continue;
+    Cost.cloneFunctionToInnerModule(F);
+    for (const BasicBlock &BB : F)
+      Sources[getCallSiteName(BB)] = &BB;
+  }
+
+  std::vector<MachineBlockCode> Blocks;
+  bool Compiled = Cost.compileMachineBlocks(Blocks);
+  Cost.clearModule();
+  if (!Compiled) {
+    errs() << "MergeBB machine duplicates: module isn't compiled\n";
+    return;
+  }
+
+  using CodeKey = std::pair<uint64_t, uint64_t>;
+  MapVector<CodeKey, SmallVector<const BasicBlock *, 4>> MachineGroups;
+  // code of IR blocks; block may be compiled into several machine blocks
+  MapVector<const BasicBlock *, CodeKey> IRBlockCode;
+  for (const MachineBlockCode &Code : Blocks) {
+    const BasicBlock *BB = Sources.lookup(Code.Source);
+    if (!BB)
+      continue;
+    CodeKey &IRCode = IRBlockCode[BB];
+    IRCode.first = hash_combine(IRCode.first, Code.Hash);
+    IRCode.second += Code.Size;
+    if (Code.Size >= MachineDuplicateMin)
+      MachineGroups[{Code.Hash, Code.Size}].push_back(BB);
+  }
+
+  size_t Duplicates = 0;
+  uint64_t MissedBytes = 0;
+  for (const auto &Group : MachineGroups) {
+    // merging keeps a single copy of every IR group
+    unsigned Copies = 0;
+    SmallSet<unsigned, 8> Merged;
+    for (const BasicBlock *BB : Group.second) {
+      auto Found = IRGroupOf.find(BB);
+      if (Found == IRGroupOf.end() || Merged.insert(Found->second).second)
+        ++Copies;
+    }
+    if (Copies < 2)
+      continue;
+
+    uint64_t Size = Group.first.second;
+    const BasicBlock *First = Group.second.front();
+    OptimizationRemarkEmitter ORE(First->getParent(), nullptr);
+    OptimizationRemarkAnalysis Remark(DEBUG_TYPE, "MachineDuplicates",
+                                      &*getBeginIt(First));
+    Remark << ore::NV("Members", Group.second.size())
+           << " blocks with identical machine code of "
+           << ore::NV("Size", Size) << " bytes, merging misses "
+           << ore::NV("Missed", Size * (Copies - 1)) << " bytes;";
+    for (const BasicBlock *BB : Group.second)
+      addBlockName(Remark, *BB);
+    ORE.emit(Remark);
+    ++Duplicates;
+    MissedBytes += Size * (Copies - 1);
+  }
+
+  MapVector<unsigned, SmallVector<const BasicBlock *, 4>> IRGroupMembers;
+  for (const auto &BlockCode : IRBlockCode) {
+    auto Found = IRGroupOf.find(BlockCode.first);
+    if (Found != IRGroupOf.end())
+      IRGroupMembers[Found->second].push_back(BlockCode.first);
+  }
+
+  size_t Diverged = 0;
+  for (const auto &Group : IRGroupMembers) {
+    SmallSet<CodeKey, 4> Codes;
+    for (const BasicBlock *BB : Group.second)
+      Codes.insert(IRBlockCode.lookup(BB));
+    if (Codes.size() < 2)
+      continue;
+
+    const BasicBlock *First = Group.second.front();
+    OptimizationRemarkEmitter ORE(First->getParent(), nullptr);
+    OptimizationRemarkAnalysis Remark(DEBUG_TYPE, "MachineDivergence",
+                                      &*getBeginIt(First));
+    Remark << ore::NV("Members", Group.second.size())
+           << " identical blocks are compiled into "
+           << ore::NV("Variants", Codes.size()) << " different codes;";
+    for (const BasicBlock *BB : Group.second)
+      addBlockName(Remark, *BB);
+    ORE.emit(Remark);
+    ++Diverged;
+  }
+
+  errs() << "MergeBB machine duplicates: " << Duplicates << " groups, "
+         << MissedBytes << " missed bytes; " << Diverged
+         << " diverged groups of identical blocks\n";
+}
 
 bool MergeBB::runOnModule(Module &M) {
   if (skipModule(M))
@@ -104,70 +555,293 @@ bool MergeBB::runOnModule(Module &M) {
   DEBUG(dbgs() << "Module name: ");
   DEBUG(dbgs().write_escaped(M.getName()) << '\n');
 
-  Cost = std::make_unique<FunctionCompiler>(M);
   FNamer = std::make_unique<FunctionNameCreator>(M);
-  if (!Cost->isInitialized())
-    return false;
-
-  std::vector<BBNode> HashedBBs;
+  if (!FastCost) {
+    Cost = std::make_unique<FunctionCompiler>(M);
+    if (!Cost->isInitialized()) {
+      Cost.reset();
+      return false;
+    }
+  }
+  if (!SiteProfileFile.empty()) {
+    std::string Error;
+    if (!SiteProfile.load(SiteProfileFile, Error))
+      errs() << "MergeBB: " << SiteProfileFile << ": " << Error << "\n";
+  }
 
-  // calculate hashes for all basic blocks in every function
+  // fingerprints of blocks by their functions. After the first round only
+  // functions, changed by the previous round, are fingerprinted again
+  FingerprintMap Fingerprints;
   for (auto &F : M.functions()) {
-    if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage()) {
-      for (auto &BB : F.getBasicBlockList())
-        if (!skipFromMerging(&BB))
-          HashedBBs.emplace_back(&BB);
+    if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage())
+      fingerprintFunction(F, Fingerprints[&F], Encodings);
+  }
+
+  if (ReportSimilar)
+    reportSimilarBlocks(Fingerprints, Encodings);
+  if (ReportMachineDuplicates) {
+    // the fast estimate doesn't compile, so the report has its own compiler
+    std::unique_ptr<FunctionCompiler> ReportCost;
+    FunctionCompiler *Compiler = Cost.get();
+    if (!Compiler) {
+      ReportCost = std::make_unique<FunctionCompiler>(M);
+      if (ReportCost->isInitialized())
+        Compiler = ReportCost.get();
     }
+    if (Compiler)
+      reportMachineDuplicates(M, *Compiler, Fingerprints,
+                              BBNodeCmp(&GlobalNumbers, &Encodings));
+    else
+      errs() << "MergeBB machine duplicates: no target to compile for\n";
   }
 
-  using VectorOfBBs = SmallVector<BasicBlock *, 16>;
-  auto BBTree =
-      std::map<BBNode, VectorOfBBs, BBNodeCmp>(BBNodeCmp(&GlobalNumbers));
+  bool Changed = false;
+  Report = DryRunReport();
+  Progress.start(ProgressInterval, Deadline, Cancel, CancelOnSignal);
+  // blocks, fingerprinted again after the previous round, and their hashes
+  DenseSet<const BasicBlock *> DirtyBBs;
+  SmallSet<BBComparator::BasicBlockHash, 16> DirtyHashes;
+
+  for (unsigned Round = 0; Round < MaxRounds; ++Round) {
+    ++RoundCounter;
+    bool IsFirstRound = Round == 0;
+
+    using VectorOfBBs = SmallVector<BasicBlock *, 16>;
+    // comparator caches results by addresses of blocks, which might have been
+    // reused by the previous round, so the table is built with a new one
+    auto BBTree =
+        std::map<BBNode, VectorOfBBs, BBNodeCmp>(
+            BBNodeCmp(&GlobalNumbers, &Encodings));
+
+    // merge hashed values into map. Next rounds group only blocks, that can
+    // be identical to dirty ones
+    for (const auto &FuncNodes : Fingerprints) {
+      for (const auto &Node : FuncNodes.second) {
+        if (!IsFirstRound && !DirtyHashes.count(Node.getHash()))
+          continue;
+        auto InsertedBBNode =
+            BBTree.insert(std::make_pair(Node, VectorOfBBs({Node.getBB()})));
+        if (!InsertedBBNode.second)
+          InsertedBBNode.first->second.push_back(Node.getBB());
+      }
+    }
 
-  // merge hashed values into map
-  for (const auto &Node : HashedBBs) {
-    auto InsertedBBNode =
-        BBTree.insert(std::make_pair(Node, VectorOfBBs({Node.getBB()})));
-    if (!InsertedBBNode.second)
-      InsertedBBNode.first->second.push_back(Node.getBB());
-  }
+    auto RemoveIf =
+        [&BBTree](const std::function<bool(const BasicBlock *)> &F) {
+          for (auto It = BBTree.begin(), EIt = BBTree.end(); It != EIt;) {
+            bool Exists = any_of(It->second, F);
+            if (Exists)
+              ++It;
+            else {
+              It = BBTree.erase(It);
+              EIt = BBTree.end();
+            }
+          }
+        };
+
+    if (!MergeSpecialFunction.empty()) {
+      RemoveIf([](const BasicBlock *BB) {
+        return BB->getParent()->getName() == MergeSpecialFunction;
+      });
+    }
+
+    if (!MergeSpecialBB.empty()) {
+      // BB's names are not saved during loading IR module.
+      // Names are concatenated with some number and hence, only
+      // the first symbols of names should be matched.
+      RemoveIf([](const BasicBlock *BB) {
+        return BB->getName().take_front(MergeSpecialBB.size()) ==
+               MergeSpecialBB;
+      });
+    }
+
+    // groups without dirty blocks were examined by the previous rounds
+    if (!IsFirstRound) {
+      RemoveIf([&DirtyBBs](const BasicBlock *BB) {
+        return DirtyBBs.count(BB) != 0;
+      });
+    }
 
-  auto RemoveIf = [&BBTree](const std::function<bool(const BasicBlock *)> &F) {
-    for (auto It = BBTree.begin(), EIt = BBTree.end(); It != EIt;) {
-      bool Exists = any_of(It->second, F);
-      if (Exists)
-        ++It;
-      else {
-        It = BBTree.erase(It);
-        EIt = BBTree.end();
+    Progress.startRound(Round, count_if(BBTree, [](const auto &Group) {
+                          return Group.second.size() >= 2;
+                        }));
+    ChangedFunctions.clear();
+    for (auto &IdenticalBlocks : BBTree) {
+      if (IdenticalBlocks.second.size() >= 2) {
+        // the current group is finished, so the module stays valid
+        if (Progress.isCancelled())
+          break;
+        Changed |= replaceGroup(IdenticalBlocks.second);
+        size_t ArenaBytes = Arena.getBytesAllocated();
+        if (ArenaBytes > ArenaPeakBytes)
+          ArenaPeakBytes = static_cast<unsigned>(ArenaBytes);
+        Arena.reset();
+        Progress.groupDone(Report.Profit);
       }
     }
-  };
 
-  if (!MergeSpecialFunction.empty()) {
-    RemoveIf([](const BasicBlock *BB) {
-      return BB->getParent()->getName() == MergeSpecialFunction;
-    });
+    if (ChangedFunctions.empty() || Progress.isCancelled())
+      break;
+
+    DEBUG(dbgs() << "Round " << Round << " changed "
+                 << ChangedFunctions.size() << " functions\n");
+
+    DirtyBBs.clear();
+    DirtyHashes.clear();
+    for (Function *F : ChangedFunctions) {
+      auto &Nodes = Fingerprints[F];
+      fingerprintFunction(*F, Nodes, Encodings);
+      for (const auto &Node : Nodes) {
+        DirtyBBs.insert(Node.getBB());
+        DirtyHashes.insert(Node.getHash());
+      }
+    }
   }
 
-  if (!MergeSpecialBB.empty()) {
-    // BB's names are not saved during loading IR module.
-    // Names are concatenated with some number and hence, only
-    // the first symbols of names should be matched.
-    RemoveIf([](const BasicBlock *BB) {
-      return BB->getName().take_front(MergeSpecialBB.size()) == MergeSpecialBB;
-    });
+  if (DryRun) {
+    errs() << "MergeBB dry run: " << Report.Profitable << " of "
+           << Report.Groups << " groups are profitable, estimated profit "
+           << Report.Profit << " bytes\n";
   }
 
-  bool Changed = false;
+  if (ShareTails && !DryRun && !FastCost && !Progress.isCancelled())
+    Changed |= shareTails(M);
+  Progress.finish();
+
+  placeCreatedFunctions(M);
+  SiteCounters.finalize(M);
+
+  // return code generation pipeline to the cache for the next runs
+  Cost.reset();
+  ChangedFunctions.clear();
+  Placements.clear();
+  BlockWeights.clear();
+  OutputSlots.clear();
+  SiteProfile = CallSiteProfile();
+  Encodings.clear();
+  return Changed;
+}
+
+/// \return frequency of \p BB: profile count, if it is available, or static
+/// estimate of executions per 1024 calls of its function
+static uint64_t getBlockWeight(const BasicBlock *BB,
+                               const BlockFrequencyInfo &BFI) {
+  if (Optional<uint64_t> Count = BFI.getBlockProfileCount(BB))
+    return *Count;
+  uint64_t EntryFreq = std::max<uint64_t>(BFI.getEntryFreq() >> 10, 1);
+  return BFI.getBlockFreq(BB).getFrequency() / EntryFreq;
+}
+
+void MergeBB::recordCallers(Function *Callee, ArrayRef<BBInfo> BBInfos) {
+  ProfileSummaryInfo &PSI =
+      getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
+  // frequencies are needed for cold blocks only with profile
+  bool UseFrequencies = !SymbolOrderFile.empty() || PSI.hasProfileSummary();
+
+  CallerInfo &Info = Placements[Callee];
+  for (auto It = BBInfos.begin(), EIt = BBInfos.end(); It != EIt;) {
+    Function *Caller = It->getBB()->getParent();
+    const BlockWeightMap *Weights =
+        UseFrequencies ? &getBlockWeights(*Caller, PSI) : nullptr;
+    do {
+      BlockWeight Weight = {1, false};
+      if (Weights) {
+        auto Found = Weights->find(It->getBB());
+        assert(Found != Weights->end() && "Weights of the caller are stale");
+        Weight = Found->second;
+      }
+      Info.Cold &= Caller->hasFnAttribute(Attribute::Cold) || Weight.Cold;
+      Info.Weights[Caller] += Weight.Weight;
+      ++It;
+    } while (It != EIt && It->getBB()->getParent() == Caller);
+  }
+}
+
+const MergeBB::BlockWeightMap &
+MergeBB::getBlockWeights(Function &Caller, ProfileSummaryInfo &PSI) {
+  auto Inserted =
+      BlockWeights.insert(std::make_pair(&Caller, BlockWeightMap()));
+  BlockWeightMap &Weights = Inserted.first->second;
+  if (!Inserted.second)
+    return Weights;
+  BlockFrequencyInfo &BFI =
+      getAnalysis<BlockFrequencyInfoWrapperPass>(Caller).getBFI();
+  for (const BasicBlock &BB : Caller)
+    Weights[&BB] = {getBlockWeight(&BB, BFI), PSI.isColdBB(&BB, &BFI)};
+  return Weights;
+}
+
+void MergeBB::moveBlockWeight(const BasicBlock *From, const BasicBlock *To) {
+  auto Cached = BlockWeights.find(To->getParent());
+  if (Cached == BlockWeights.end())
+    return;
+  BlockWeightMap &Weights = Cached->second;
+  auto Found = Weights.find(From);
+  if (Found == Weights.end())
+    return;
+  BlockWeight Weight = Found->second;
+  Weights.erase(Found);
+  Weights[To] = Weight;
+}
 
-  for (auto &IdenticalBlocks : BBTree) {
-    if (IdenticalBlocks.second.size() >= 2) {
-      Changed |= replace(IdenticalBlocks.second);
+void MergeBB::placeCreatedFunctions(Module &M) {
+  // hot created functions by their most frequent callers
+  MapVector<Function *, SmallVector<Function *, 4>> Hot;
+  for (auto &Placement : Placements) {
+    Function *F = Placement.first;
+    const CallerInfo &Info = Placement.second;
+    if (Info.Cold) {
+      if (!PlaceCold)
+        continue;
+      if (ColdSection.empty())
+        F->setSectionPrefix(".unlikely");
+      else
+        F->setSection(ColdSection);
+      ++ColdFunctionCounter;
+      continue;
     }
+    auto Dominant = std::max_element(
+        Info.Weights.begin(), Info.Weights.end(),
+        [](const std::pair<Function *, uint64_t> &L,
+           const std::pair<Function *, uint64_t> &R) {
+          return L.second < R.second;
+        });
+    Hot[Dominant->first].push_back(F);
   }
 
-  return Changed;
+  if (SymbolOrderFile.empty())
+    return;
+
+  std::error_code EC;
+  raw_fd_ostream OS(SymbolOrderFile, EC, sys::fs::F_Text);
+  if (EC) {
+    errs() << "MergeBB: " << SymbolOrderFile << ": " << EC.message() << "\n";
+    return;
+  }
+
+  // every function is followed by the hot functions, created for it.
+  // Created functions become local symbols to be ordered by linker
+  Mangler Mang;
+  SmallPtrSet<const Function *, 16> Written;
+  std::function<void(Function *)> Write = [&](Function *F) {
+    if (!Written.insert(F).second)
+      return;
+    if (F->hasPrivateLinkage())
+      F->setLinkage(GlobalValue::InternalLinkage);
+    SmallString<64> Name;
+    Mang.getNameWithPrefix(Name, F, false);
+    OS << Name << '\n';
+    auto Found = Hot.find(F);
+    if (Found != Hot.end())
+      for (Function *Callee : Found->second)
+        Write(Callee);
+  };
+  // callers, which aren't created functions, go first
+  for (auto &CallerAndCallees : Hot)
+    if (!Placements.count(CallerAndCallees.first))
+      Write(CallerAndCallees.first);
+  for (auto &CallerAndCallees : Hot)
+    Write(CallerAndCallees.first);
 }
 
 static void debugPrint(const BasicBlock *BB, const StringRef Str = "",
@@ -177,7 +851,7 @@ static void debugPrint(const BasicBlock *BB, const StringRef Str = "",
                << (NewLine ? '\n' : ' '));
 }
 
-static bool skipFromMerging(const BasicBlock *BB) {
+bool llvm::skipFromMerging(const BasicBlock *BB) {
   if (BB->size() <= 3)
     return true;
 
@@ -258,20 +932,25 @@ static SmallVector<size_t, 8> getOutput(const BasicBlock *BB) {
 }
 
 /// Converts instruction numbers of \p BB
-/// into Values * \p NumsInstr
-static SmallVector<Instruction *, 8>
-convertInstIds(BasicBlock *BB, const BBInstIdsImpl &NumsInstr) {
-  SmallVector<Instruction *, 8> Result;
-  Result.reserve(NumsInstr.size());
+/// into Values * \p NumsInstr and writes them into \p Result
+static void convertInstIds(BasicBlock *BB, const BBInstIdsImpl &NumsInstr,
+                           MutableArrayRef<Instruction *> Result) {
+  assert(Result.size() == NumsInstr.size() && "Sizes must be equal");
   if (NumsInstr.empty())
-    return Result;
+    return;
   auto It = getBeginIt(BB);
   std::advance(It, NumsInstr.front());
-  Result.push_back(&*It);
+  Result[0] = &*It;
   for (size_t i = 1, isz = NumsInstr.size(); i < isz; ++i) {
     std::advance(It, NumsInstr[i] - NumsInstr[i - 1]);
-    Result.push_back(&*It);
+    Result[i] = &*It;
   }
+}
+
+static SmallVector<Instruction *, 8>
+convertInstIds(BasicBlock *BB, const BBInstIdsImpl &NumsInstr) {
+  SmallVector<Instruction *, 8> Result(NumsInstr.size());
+  convertInstIds(BB, NumsInstr, Result);
   return Result;
 }
 
@@ -283,13 +962,17 @@ namespace {
 /// Creates for every equal set of BBs
 class BBsCommonInfo {
 public:
-  BBsCommonInfo(ArrayRef<BasicBlock *> BBs, const TargetTransformInfo &TTI);
+  BBsCommonInfo(ArrayRef<BasicBlock *> BBs, const TargetTransformInfo &TTI,
+                GroupArena &Arena);
 
   const BBInstIdsImpl &getOutputIds() const { return OutputIds; }
   const InstructionLocation &getSpecialInsts() const { return SpecialInsts; }
 
   size_t getReturnValueId() const { return ReturnValueOutputId; }
 
+  /// Memory for the state of every BB of the group
+  GroupArena &getArena() const { return Arena; }
+
 private:
   /// merges exsistent output OutputIds with \p Ids
   /// e.g.
@@ -317,13 +1000,15 @@ private:
   size_t ReturnValueOutputId;
 
   InstructionLocation SpecialInsts;
+
+  GroupArena &Arena;
 };
 
 } // end anonymous namespace
 
 BBsCommonInfo::BBsCommonInfo(ArrayRef<BasicBlock *> BBs,
-                             const TargetTransformInfo &TTI)
-    : OutputIds(getOutput(BBs.front())) {
+                             const TargetTransformInfo &TTI, GroupArena &Arena)
+    : OutputIds(getOutput(BBs.front())), Arena(Arena) {
   std::for_each(BBs.begin() + 1, BBs.end(), [this](const BasicBlock *BB) {
     this->mergeOutput(getOutput(BB));
   });
@@ -374,7 +1059,8 @@ InstOutPos(const Instruction *I,
     auto IOp = dyn_cast<Instruction>(Op);
     if (!IOp)
       continue;
-    if (IOp->getParent() != BB || isa<PHINode>(IOp) || isa<TerminatorInst>(IOp))
+    if (IOp->getParent() != BB || precedesMergedPart(*IOp) ||
+        isa<TerminatorInst>(IOp))
       continue;
     if (UsedBefore.find(IOp) != UsedBefore.end())
       continue;
@@ -472,8 +1158,8 @@ setTypeCommonCase(const Instruction *I,
 void BBsCommonInfo::setSpecialInsts(const TargetTransformInfo &TTI,
                                     BasicBlock *BB) {
   const SmartSortedSet<Instruction *> OutputsSet(convertInstIds(BB, OutputIds));
-  SmallPtrSet<const Value *, 8> BBSpecialBefore;
-  SmallPtrSet<const Value *, 8> BBSpecialAfter;
+  SmallPtrSetImpl<const Value *> &BBSpecialBefore = Arena.getBeforeSet();
+  SmallPtrSetImpl<const Value *> &BBSpecialAfter = Arena.getAfterSet();
   //  SmallPtrSet<const Value *, 8> BBSkippedInstsOut;
 
   auto RemoveOutput = [&](size_t InstNum, Instruction *Inst) {
@@ -510,7 +1196,7 @@ void BBsCommonInfo::setSpecialInsts(const TargetTransformInfo &TTI,
 
   // remove reduntant Instructions from function, i.e
   // if it is possible to move away instruction from function, move it.
-  DenseSet<Value *> UsedValues;
+  DenseSet<const Value *> &UsedValues = Arena.getValueSet();
 
   auto RIt = getEndIt(BB), REIt = getBeginIt(BB);
   // insert return value from TerminatorInst
@@ -563,7 +1249,9 @@ namespace {
 
 /// Class, that keeps all important information about each basic block,
 /// that is going to be factor out. Evaluates values as lazy as possible
-/// It is created for every BB individually
+/// It is created for every BB individually. Inputs and outputs are
+/// allocated in the group arena, so BBInfo is cheap to copy and doesn't
+/// need to be destroyed
 class BBInfo {
 
 public:
@@ -579,13 +1267,19 @@ public:
   void setBB(BasicBlock *BB) {
     this->BB = BB;
     Inputs.reset();
-    Outputs.clear();
+    Outputs = None;
     ReturnValue = nullptr;
   }
+
+  /// Moves info to \p Clone, a block identical to the current one, e.g. in
+  /// the inner module of the cost model. Sunk and permuted inputs are mapped
+  /// to the clone by their positions among all inputs of the blocks
+  void setClonedBB(BasicBlock *Clone);
+
   BasicBlock *getBB() const { return BB; }
 
-  const SmallVector<Value *, 8> &getInputs() const;
-  const SmallVector<Instruction *, 8> &getOutputs() const;
+  ArrayRef<Value *> getInputs() const;
+  ArrayRef<Instruction *> getOutputs() const;
 
   const InstructionLocation &getSpecial() const {
     return CommonInfo.getSpecialInsts();
@@ -597,7 +1291,7 @@ public:
   /// Inputs: [0, 2, 3]
   /// Permut: [2, 0, 1]
   /// In result Input will be equal [3, 0, 2]
-  void permutateInputs(const SmallVectorImpl<size_t> &Permut);
+  void permutateInputs(ArrayRef<size_t> Permut);
   Value *getReturnValue() const;
 
 private:
@@ -608,8 +1302,8 @@ private:
 
   const BBsCommonInfo &CommonInfo;
 
-  mutable Optional<SmallVector<Value *, 8>> Inputs;
-  mutable SmallVector<Instruction *, 8> Outputs;
+  mutable Optional<MutableArrayRef<Value *>> Inputs;
+  mutable MutableArrayRef<Instruction *> Outputs;
 
   mutable Value *ReturnValue = nullptr;
 };
@@ -628,11 +1322,12 @@ BBInfo &BBInfo::operator=(const BBInfo &Other) {
 }
 
 /// \return Values, that were created outside of the merged \p BB
-static SmallVector<Value *, 8>
-getInput(BasicBlock *BB, const InstructionLocation &SpecialInsts) {
+static MutableArrayRef<Value *>
+getInput(BasicBlock *BB, const InstructionLocation &SpecialInsts,
+         GroupArena &Arena) {
   // Values, created by merged BB or inserted into Result as Input
-  DenseSet<const Value *> Values;
-  SmallVector<Value *, 8> Result;
+  DenseSet<const Value *> &Values = Arena.getValueSet();
+  SmallVectorImpl<Value *> &Result = Arena.getValueList();
 
   size_t InstNum = 0;
   for (auto I = getBeginIt(BB), IE = getEndIt(BB); I != IE; ++I, ++InstNum) {
@@ -655,36 +1350,56 @@ getInput(BasicBlock *BB, const InstructionLocation &SpecialInsts) {
       }
     }
   }
-  return Result;
+  return Arena.copy<Value *>(Result);
 }
 
-const SmallVector<Value *, 8> &BBInfo::getInputs() const {
+ArrayRef<Value *> BBInfo::getInputs() const {
   if (!Inputs)
-    Inputs = getInput(BB, CommonInfo.getSpecialInsts());
+    Inputs = getInput(BB, CommonInfo.getSpecialInsts(), CommonInfo.getArena());
   return *Inputs;
 }
 
-const SmallVector<Instruction *, 8> &BBInfo::getOutputs() const {
+ArrayRef<Instruction *> BBInfo::getOutputs() const {
   const auto &OutputIds = CommonInfo.getOutputIds();
-  if (!ReturnValue && !OutputIds.empty() && Outputs.empty())
-    Outputs = convertInstIds(BB, OutputIds);
+  if (!ReturnValue && !OutputIds.empty() && Outputs.empty()) {
+    Outputs = CommonInfo.getArena().allocate<Instruction *>(OutputIds.size());
+    convertInstIds(BB, OutputIds, Outputs);
+  }
   return Outputs;
 }
 
-/// \return vector of \p Inputs, permutated with \p Permuts
-static SmallVector<Value *, 8>
-applyPermutation(const SmallVectorImpl<Value *> &Inputs,
-                 const SmallVectorImpl<size_t> &Permuts) {
-  SmallVector<Value *, 8> Result;
-  Result.reserve(Inputs.size());
-  for (size_t Perm : Permuts) {
-    Result.push_back(Inputs[Perm]);
+/// \return array of \p Inputs, permutated with \p Permuts
+static MutableArrayRef<Value *> applyPermutation(ArrayRef<Value *> Inputs,
+                                                 ArrayRef<size_t> Permuts,
+                                                 GroupArena &Arena) {
+  MutableArrayRef<Value *> Result = Arena.allocate<Value *>(Permuts.size());
+  for (size_t i = 0, ei = Permuts.size(); i < ei; ++i) {
+    Result[i] = Inputs[Permuts[i]];
   }
   return Result;
 }
 
-void BBInfo::permutateInputs(const SmallVectorImpl<size_t> &Permut) {
-  Inputs = applyPermutation(getInputs(), Permut);
+void BBInfo::setClonedBB(BasicBlock *Clone) {
+  Optional<MutableArrayRef<Value *>> Mapped;
+  if (Inputs) {
+    GroupArena &Arena = CommonInfo.getArena();
+    const InstructionLocation &SpecialInsts = CommonInfo.getSpecialInsts();
+    ArrayRef<Value *> Original = getInput(BB, SpecialInsts, Arena);
+    ArrayRef<Value *> Cloned = getInput(Clone, SpecialInsts, Arena);
+    assert(Original.size() == Cloned.size() && "Blocks must be identical");
+    Mapped = Arena.allocate<Value *>(Inputs->size());
+    for (size_t i = 0, ei = Inputs->size(); i < ei; ++i) {
+      size_t Id = find(Original, (*Inputs)[i]) - Original.begin();
+      assert(Id != Original.size() && "Value must be an input of the block");
+      (*Mapped)[i] = Cloned[Id];
+    }
+  }
+  setBB(Clone);
+  Inputs = Mapped;
+}
+
+void BBInfo::permutateInputs(ArrayRef<size_t> Permut) {
+  Inputs = applyPermutation(getInputs(), Permut, CommonInfo.getArena());
 }
 
 void BBInfo::extractReturnValue(const size_t ResultId) const {
@@ -696,7 +1411,7 @@ void BBInfo::extractReturnValue(const size_t ResultId) const {
 
   ReturnValue = Outputs[ResultId];
   Outputs[ResultId] = Outputs.back();
-  Outputs.pop_back();
+  Outputs = Outputs.drop_back();
 }
 
 Value *BBInfo::getReturnValue() const {
@@ -734,13 +1449,154 @@ static bool canThrow(const BasicBlock *BB) {
   return false;
 }
 
+/// \return whether \p I accesses only memory, pointed by arguments
+static bool accessesArgMemOnly(const Instruction &I, const DataLayout &DL) {
+  auto IsArgPtr = [&DL](const Value *Ptr) {
+    return isa<Argument>(GetUnderlyingObject(Ptr, DL));
+  };
+  if (auto *LI = dyn_cast<LoadInst>(&I))
+    return IsArgPtr(LI->getPointerOperand());
+  if (auto *SI = dyn_cast<StoreInst>(&I))
+    return IsArgPtr(SI->getPointerOperand());
+  if (auto *RMW = dyn_cast<AtomicRMWInst>(&I))
+    return IsArgPtr(RMW->getPointerOperand());
+  if (auto *CmpXchg = dyn_cast<AtomicCmpXchgInst>(&I))
+    return IsArgPtr(CmpXchg->getPointerOperand());
+  ImmutableCallSite CS(&I);
+  if (!CS || !CS.onlyAccessesArgMemory())
+    return CS && CS.doesNotAccessMemory();
+  return all_of(CS.args(), [&IsArgPtr](const Use &Arg) {
+    return !Arg->getType()->isPointerTy() || IsArgPtr(Arg);
+  });
+}
+
+/// Infers memory and capture attributes of created function \p F from its
+/// straight-line body, so that alias analysis of callers isn't worse, than
+/// it was for the merged block
+static void inferAttributes(Function &F) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  bool Reads = false;
+  bool Writes = false;
+  bool ArgMemOnly = true;
+  // arguments, dereferenced before anything may stop the execution
+  SmallPtrSet<const Value *, 8> Dereferenced;
+  bool Reached = true;
+  for (const Instruction &I : F.front()) {
+    if (I.mayReadOrWriteMemory()) {
+      Reads |= I.mayReadFromMemory();
+      Writes |= I.mayWriteToMemory();
+      ArgMemOnly &= accessesArgMemOnly(I, DL);
+    }
+    if (!Reached)
+      continue;
+    const Value *Ptr = nullptr;
+    if (auto *LI = dyn_cast<LoadInst>(&I))
+      Ptr = LI->isVolatile() ? nullptr : LI->getPointerOperand();
+    else if (auto *SI = dyn_cast<StoreInst>(&I))
+      Ptr = SI->isVolatile() ? nullptr : SI->getPointerOperand();
+    // inbounds offsets of null are poison, so the base isn't null too
+    if (Ptr)
+      Dereferenced.insert(Ptr->stripInBoundsOffsets());
+    Reached = isGuaranteedToTransferExecutionToSuccessor(&I);
+  }
+
+  if (!Writes)
+    F.addFnAttr(Reads ? Attribute::ReadOnly : Attribute::ReadNone);
+  if (ArgMemOnly && (Reads || Writes))
+    F.addFnAttr(Attribute::ArgMemOnly);
+
+  for (Argument &Arg : F.args()) {
+    auto *PtrTy = dyn_cast<PointerType>(Arg.getType());
+    if (!PtrTy)
+      continue;
+    if (!PointerMayBeCaptured(&Arg, /*ReturnCaptures=*/true,
+                              /*StoreCaptures=*/true))
+      Arg.addAttr(Attribute::NoCapture);
+    if (PtrTy->getAddressSpace() == 0 && Dereferenced.count(&Arg))
+      Arg.addAttr(Attribute::NonNull);
+  }
+}
+
+/// \return whether \p I can be computed by the created function instead of
+/// its caller
+static bool isRematerializable(const Instruction *I) {
+  return !isa<PHINode>(I) && !I->mayReadFromMemory() &&
+         !I->getType()->isTokenTy() && isSafeToSpeculativelyExecute(I);
+}
+
+/// Inputs, computed in the same way at every call site from constants and
+/// other inputs, are removed from \p BBInfos. The created function computes
+/// them from its arguments, so calls pass less arguments. Instructions stay
+/// in callers, because their blocks might be members of other groups: they
+/// are dead, if only merged blocks used them, and are removed by codegen
+/// \return sunk inputs of the model
+static SmallVector<Instruction *, 4>
+sinkInvariantInputs(MutableArrayRef<BBInfo> BBInfos) {
+  ArrayRef<Value *> ModelInputs = BBInfos.front().getInputs();
+  SmallVector<Instruction *, 4> Sunk;
+  SmallVector<size_t, 8> Kept;
+
+  // \return id of the model input, corresponding to operand of the model
+  // input instruction, or None, if operand is a constant
+  auto GetInputId = [ModelInputs](const Value *Op) -> Optional<size_t> {
+    if (isa<Constant>(Op))
+      return None;
+    return static_cast<size_t>(find(ModelInputs, Op) - ModelInputs.begin());
+  };
+
+  auto IsInvariant = [&](size_t Id) {
+    auto *Model = dyn_cast<Instruction>(ModelInputs[Id]);
+    if (!Model || !isRematerializable(Model))
+      return false;
+    for (const Use &Op : Model->operands()) {
+      Optional<size_t> OpId = GetInputId(Op.get());
+      // sunk input is computed from passed ones only
+      if (OpId && (*OpId == ModelInputs.size() ||
+                   (isa<Instruction>(ModelInputs[*OpId]) &&
+                    isRematerializable(cast<Instruction>(ModelInputs[*OpId])))))
+        return false;
+    }
+    for (const BBInfo &Info : BBInfos.drop_front()) {
+      ArrayRef<Value *> Inputs = Info.getInputs();
+      auto *Site = dyn_cast<Instruction>(Inputs[Id]);
+      if (!Site || !Site->isSameOperationAs(Model))
+        return false;
+      for (unsigned j = 0, je = Model->getNumOperands(); j < je; ++j) {
+        Optional<size_t> OpId = GetInputId(Model->getOperand(j));
+        Value *Expected = OpId ? Inputs[*OpId] : Model->getOperand(j);
+        if (Site->getOperand(j) != Expected)
+          return false;
+      }
+    }
+    return true;
+  };
+
+  for (size_t i = 0, ei = ModelInputs.size(); i < ei; ++i) {
+    if (IsInvariant(i))
+      Sunk.push_back(cast<Instruction>(ModelInputs[i]));
+    else
+      Kept.push_back(i);
+  }
+
+  if (!Sunk.empty()) {
+    for (BBInfo &Info : BBInfos)
+      Info.permutateInputs(Kept);
+  }
+  return Sunk;
+}
+
 // TODO: ? set input attributes from created BB
 /// \param Info - Information about model basic block
+/// \param Invariant - inputs of \p Info BB, computed by the function
+/// \param NumFlat - number of inputs, passed as arguments. Others are packed
+/// into a struct, passed by pointer before output pointers
 /// \return new function, that consists of Basic block \p Info BB
-static Function *createFuncFromBB(const BBInfo &Info) {
+static Function *createFuncFromBB(const BBInfo &Info,
+                                  ArrayRef<Instruction *> Invariant,
+                                  size_t NumFlat, GroupArena &Arena) {
   BasicBlock *BB = Info.getBB();
-  auto &Input = Info.getInputs();
-  auto &Output = Info.getOutputs();
+  ArrayRef<Value *> Input = Info.getInputs();
+  ArrayRef<Instruction *> Output = Info.getOutputs();
   const Value *ReturnValue = Info.getReturnValue();
   auto &SpecialInsts = Info.getSpecial();
 
@@ -753,6 +1609,13 @@ static Function *createFuncFromBB(const BBInfo &Info) {
 
   std::transform(Input.begin(), Input.end(), std::back_inserter(Params),
                  [](const Value *V) { return V->getType(); });
+  StructType *PackTy = nullptr;
+  if (NumFlat != Input.size()) {
+    PackTy = StructType::get(Context, makeArrayRef(Params).drop_front(NumFlat));
+    Params.resize(NumFlat);
+    Params.push_back(PackTy->getPointerTo());
+  }
+  size_t NumInputParams = Params.size();
 
   Type *FunctionReturnT =
       ReturnValue ? ReturnValue->getType() : Type::getVoidTy(Context);
@@ -775,8 +1638,11 @@ static Function *createFuncFromBB(const BBInfo &Info) {
   if (!Throws)
     F->addFnAttr(Attribute::NoUnwind);
 
-  // set attributes to all output params
-  for (size_t i = Input.size() + 1, ie = Params.size() + 1; i < ie; ++i) {
+  // set attributes to all output params and the pack
+  if (PackTy)
+    F->addAttribute(static_cast<unsigned>(NumInputParams),
+                    Attribute::get(Context, Attribute::AttrKind::ReadOnly));
+  for (size_t i = NumFlat + 1, ie = Params.size() + 1; i < ie; ++i) {
     F->addAttribute(
         static_cast<unsigned>(i),
         Attribute::get(
@@ -787,15 +1653,27 @@ static Function *createFuncFromBB(const BBInfo &Info) {
   }
 
   // create auxiliary Map from Input to function arguments
-  DenseMap<const Value *, Value *> InputToArgs;
+  DenseMap<const Value *, Value *> &InputToArgs = Arena.getInputMap();
   // create auxiliary Map from Output to function arguments
-  DenseMap<const Value *, Value *> OutputToArgs;
+  DenseMap<const Value *, Value *> &OutputToArgs = Arena.getOutputMap();
+  BasicBlock *NewBB = BasicBlock::Create(Context, "Entry", F);
+  IRBuilder<> Builder(NewBB);
   {
     auto ArgIt = F->arg_begin();
 
-    for (auto It = Input.begin(), EIt = Input.end(); It != EIt; ++It) {
+    for (auto It = Input.begin(), EIt = Input.begin() + NumFlat; It != EIt;
+         ++It) {
       InputToArgs.insert(std::make_pair(*It, &*ArgIt++));
     }
+    // packed inputs are loaded at the beginning
+    if (PackTy) {
+      Argument *Pack = &*ArgIt++;
+      for (size_t i = NumFlat, ie = Input.size(); i < ie; ++i) {
+        Value *Field = Builder.CreateStructGEP(
+            PackTy, Pack, static_cast<unsigned>(i - NumFlat));
+        InputToArgs.insert(std::make_pair(Input[i], Builder.CreateLoad(Field)));
+      }
+    }
     for (auto It = Output.begin(), EIt = Output.end(); It != EIt; ++It) {
       OutputToArgs.insert(std::make_pair(*It, &*ArgIt++));
     }
@@ -804,10 +1682,19 @@ static Function *createFuncFromBB(const BBInfo &Info) {
   // Fill function, using BB with some changes:
   // Replace all input values with Function arguments
   // Store all output values to Function arguments
-  BasicBlock *NewBB = BasicBlock::Create(Context, "Entry", F);
-  IRBuilder<> Builder(NewBB);
   Value *ReturnValueF = nullptr;
 
+  // inputs, which are the same for all calls, are computed from arguments
+  for (Instruction *I : Invariant) {
+    Instruction *NewI = Builder.Insert(I->clone());
+    for (auto &Op : NewI->operands()) {
+      auto FoundIter = InputToArgs.find(Op.get());
+      if (FoundIter != InputToArgs.end())
+        Op.set(FoundIter->second);
+    }
+    InputToArgs.insert(std::make_pair(I, NewI));
+  }
+
   size_t i = 0;
   for (auto It = getBeginIt(BB), EIt = getEndIt(BB); It != EIt; ++It, ++i) {
     Instruction *I = &*It;
@@ -842,16 +1729,77 @@ static Function *createFuncFromBB(const BBInfo &Info) {
   else
     Builder.CreateRetVoid();
 
+  inferAttributes(*F);
   ++FunctionCounter;
   return F;
 }
 
+/// \return number of inputs of \p Info, that are passed in registers, if
+/// the rest is packed into a struct, or number of all inputs, if they fit
+static size_t getNumRegisterInputs(const BBInfo &Info) {
+  size_t NumInputs = Info.getInputs().size();
+  size_t NumOutputs = Info.getOutputs().size();
+  if (RegisterArgs == 0 || NumInputs + NumOutputs <= RegisterArgs)
+    return NumInputs;
+  // pointer to the pack takes a register too
+  size_t NumRegisters =
+      RegisterArgs > NumOutputs + 1 ? RegisterArgs - NumOutputs - 1 : 0;
+  // pack replaces at least 2 inputs
+  return NumInputs >= NumRegisters + 2 ? NumRegisters : NumInputs;
+}
+
+/// \return number of inputs of \p Info, that are passed to \p F as
+/// arguments. Others are packed into a struct by createFuncFromBB
+static size_t getNumFlatInputs(const Function *F, const BBInfo &Info) {
+  size_t NumInputs = Info.getInputs().size();
+  size_t NumOutputs = Info.getOutputs().size();
+  if (F->arg_size() == NumInputs + NumOutputs)
+    return NumInputs;
+  assert(F->arg_size() + 1 < NumInputs + NumOutputs &&
+         "Pack must replace several inputs");
+  return F->arg_size() - NumOutputs - 1;
+}
+
+/// \return slots for outputs of calls of \p Callee from \p Caller. They are
+/// allocated in the entry block once, so no stack adjustment happens in loops
+static SmallVector<AllocaInst *, 4> getOutputSlots(Function *Caller,
+                                                  Function *Callee,
+                                                  size_t NumInputs,
+                                                  OutputSlotMap &Slots) {
+  auto &Cached = Slots[std::make_pair(Caller, Callee)];
+  SmallVector<AllocaInst *, 4> Result;
+  for (Value *Slot : Cached) {
+    if (!Slot) {
+      Result.clear();
+      break;
+    }
+    Result.push_back(cast<AllocaInst>(Slot));
+  }
+  if (!Result.empty() || Callee->arg_size() == NumInputs)
+    return Result;
+
+  Cached.clear();
+  BasicBlock &Entry = Caller->getEntryBlock();
+  IRBuilder<> Builder(&Entry, Entry.begin());
+  for (auto ArgIt = std::next(Callee->arg_begin(), NumInputs),
+            ArgEnd = Callee->arg_end();
+       ArgIt != ArgEnd; ++ArgIt) {
+    Result.push_back(
+        Builder.CreateAlloca(ArgIt->getType()->getPointerElementType()));
+    Cached.push_back(Result.back());
+  }
+  return Result;
+}
+
 /// \param Info - Basic block, which is going to be replaced with function call
 /// to \p F
-static void replaceBBWithCall(BBInfo &Info, Function *F) {
+/// \param Slots - output slots, allocated for previous calls
+/// \param Counter - counter of executions of the call, if it is instrumented
+static void replaceBBWithCall(BBInfo &Info, Function *F, OutputSlotMap &Slots,
+                              GlobalVariable *Counter = nullptr) {
   BasicBlock *BB = Info.getBB();
-  auto &Input = Info.getInputs();
-  auto &Output = Info.getOutputs();
+  ArrayRef<Value *> Input = Info.getInputs();
+  ArrayRef<Instruction *> Output = Info.getOutputs();
   Value *Result = Info.getReturnValue();
   SmallVector<Instruction *, 8> UsedBefore;
   SmallVector<Instruction *, 8> UsedAfter;
@@ -876,7 +1824,14 @@ static void replaceBBWithCall(BBInfo &Info, Function *F) {
   // 0) Prepare auxiliary utils
 
   auto NewBB = BasicBlock::Create(BB->getContext(), "", BB->getParent(), BB);
+  // new block is the entry one, if BB was, so slots are placed into it.
+  // Packed inputs have the first slot
+  size_t NumFlat = getNumFlatInputs(F, Info);
+  bool Packed = NumFlat != Input.size();
+  SmallVector<AllocaInst *, 4> OutputSlots =
+      getOutputSlots(BB->getParent(), F, NumFlat, Slots);
   IRBuilder<> Builder(NewBB);
+  const DataLayout &DL = F->getParent()->getDataLayout();
 
   auto GetValueForArgs = [&Builder](Value *V, Type *T) {
     if (V->getType() == T)
@@ -913,25 +1868,49 @@ static void replaceBBWithCall(BBInfo &Info, Function *F) {
 
   // 3) Create Argument list for function call
   SmallVector<Value *, 8> Args;
-  assert(F->arg_size() == Input.size() + Output.size() &&
+  assert(F->arg_size() == NumFlat + Packed + Output.size() &&
          "Argument sizes not match");
   Args.reserve(F->arg_size());
 
   auto CurArg = F->arg_begin();
   // 3a) Append Input arguments into call argument list
-  for (auto I = Input.begin(), IE = Input.end(); I != IE; ++I, ++CurArg) {
+  for (auto I = Input.begin(), IE = Input.begin() + NumFlat; I != IE;
+       ++I, ++CurArg) {
     Args.push_back(GetValueForArgs(*I, CurArg->getType()));
   }
-  // 3b) Allocate space for output pointers, that are Output function arguments
-  for (auto IE = F->arg_end(); CurArg != IE; ++CurArg) {
-    Args.push_back(
-        Builder.CreateAlloca(CurArg->getType()->getPointerElementType()));
+  // 3b) Pack and output pointers are slots, shared by calls of F. They live
+  // only during this call and reload of outputs
+  for (AllocaInst *Slot : OutputSlots) {
+    Builder.CreateLifetimeStart(
+        Slot, Builder.getInt64(DL.getTypeAllocSize(Slot->getAllocatedType())));
+    Args.push_back(Slot);
+  }
+  if (Packed) {
+    AllocaInst *Pack = OutputSlots.front();
+    auto *PackTy = cast<StructType>(Pack->getAllocatedType());
+    for (size_t i = NumFlat, ie = Input.size(); i < ie; ++i) {
+      unsigned Field = static_cast<unsigned>(i - NumFlat);
+      Builder.CreateStore(
+          GetValueForArgs(Input[i], PackTy->getElementType(Field)),
+          Builder.CreateStructGEP(PackTy, Pack, Field));
+    }
   }
 
-  // 4) Create a call
+  // 4) Create a call, counted by instrumentation
+  if (Counter)
+    Builder.CreateAtomicRMW(AtomicRMWInst::Add, Counter, Builder.getInt64(1),
+                            AtomicOrdering::Monotonic);
   CallInst *TailCallInst = Builder.CreateCall(F, Args);
-  TailCallInst->setTailCallKind(CallInst::TailCallKind::TCK_Tail);
+  // callee of tail call doesn't access allocas of the caller
+  if (OutputSlots.empty())
+    TailCallInst->setTailCallKind(CallInst::TailCallKind::TCK_Tail);
   TailCallInst->setCallingConv(F->getCallingConv());
+  // facts about values of this caller, which don't hold for every call
+  for (unsigned i = 0, ie = Args.size(); i < ie; ++i)
+    if (Args[i]->getType()->isPointerTy() &&
+        !std::next(F->arg_begin(), i)->hasNonNullAttr() &&
+        isKnownNonZero(Args[i], DL, 0, nullptr, TailCallInst))
+      TailCallInst->addParamAttr(i, Attribute::NonNull);
   if (Result) {
     Value *ResultReplace = GetValueForArgs(TailCallInst, Result->getType());
     ResultReplace->takeName(Result);
@@ -939,7 +1918,7 @@ static void replaceBBWithCall(BBInfo &Info, Function *F) {
   }
 
   // 5) Save and Replace all Output values
-  auto AllocaIt = Args.begin() + Input.size();
+  auto AllocaIt = Args.begin() + NumFlat + Packed;
   for (auto It = Output.begin(), EIt = Output.end(); It != EIt;
        ++It, ++AllocaIt) {
     Instruction *CurrentInst = *It;
@@ -952,6 +1931,9 @@ static void replaceBBWithCall(BBInfo &Info, Function *F) {
     BitCasted->takeName(CurrentInst);
     CurrentInst->replaceAllUsesWith(BitCasted);
   }
+  for (AllocaInst *Slot : OutputSlots)
+    Builder.CreateLifetimeEnd(
+        Slot, Builder.getInt64(DL.getTypeAllocSize(Slot->getAllocatedType())));
 
   // 6) Store all Insts, used after function call
   for (auto I : UsedAfter) {
@@ -983,7 +1965,7 @@ static void replaceBBWithCall(BBInfo &Info, Function *F) {
 /// other basic blocks
 static bool isMergeable(const BBInfo &Info, SmallVectorImpl<size_t> &Permut) {
   const Function *F = Info.getBB()->getParent();
-  const SmallVectorImpl<Value *> &Inputs = Info.getInputs();
+  ArrayRef<Value *> Inputs = Info.getInputs();
 
   assert(F->size() == 1);
   if (F->isVarArg())
@@ -1036,11 +2018,12 @@ static size_t findAppropriateBBsId(const ArrayRef<BBInfo> BBs,
 /// \param F ~ Function to be called
 /// \param OtherInfo ~ Info, going to be cloned and used for factoring out
 /// \param BB ~ Basic block that is going to be factored out
+/// \param Slots ~ output slots of the other module
 static void replaceBBInOtherFunction(Function *F, const BBInfo &OtherInfo,
-                                     BasicBlock *BB) {
+                                     BasicBlock *BB, OutputSlotMap &Slots) {
   BBInfo M2BBInfo = OtherInfo;
-  M2BBInfo.setBB(BB);
-  replaceBBWithCall(M2BBInfo, F);
+  M2BBInfo.setClonedBB(BB);
+  replaceBBWithCall(M2BBInfo, F, Slots);
 }
 
 // \p F is our merged function, \p MBBInfos are going to make a call to it.
@@ -1059,23 +2042,66 @@ static Function *addReplacedFunction(FunctionCompiler &FC, Function *F,
       FC.cloneInnerFunction(*CommonFunction, ClonedBB,
                             std::string(CommonFunction->getName()) + ".new");
 
-  replaceBBInOtherFunction(F, MBBInfo, ClonedBB);
+  OutputSlotMap Slots;
+  replaceBBInOtherFunction(F, MBBInfo, ClonedBB, Slots);
 
   for (size_t i = 1, ei = MBBInfos.size(); i < ei; ++i) {
     const BBInfo &I = MBBInfos[i];
     BasicBlock *BB =
         getMappedBBofIdenticalFunctions(I.getBB(), NewCommonFunction);
-    replaceBBInOtherFunction(F, MBBInfo, BB);
+    replaceBBInOtherFunction(F, MBBInfo, BB, Slots);
   }
 
   return NewCommonFunction;
 }
 
-// TODO: collapse shouldReplaceCommonChoice and shouldReplacePreciseChoice
+// TODO: collapse measureCommonChoice and measurePreciseChoice
+
+namespace {
+
+/// Sizes of the functions, affected by merging of a group of identical BBs.
+/// It is filled by the cost model and is used for making a decision and
+/// for reporting it. Sizes include alignment padding of functions
+struct MergeCost {
+  /// Sum of sizes of affected functions before merging
+  int64_t OldSize = 0;
+  /// Sum of sizes of affected functions after merging, including size of
+  /// the created function
+  int64_t NewSize = 0;
+  /// Exception handling tables size difference (old - new)
+  int64_t EHDelta = 0;
+  /// Additional padding of the created function, if it gets preferred
+  /// alignment instead of the minimal one
+  int64_t PrefAlignCost = 0;
+  /// The created function gets preferred alignment
+  bool PrefAlign = false;
+
+  int64_t getProfit() const {
+    return OldSize - NewSize + EHDelta - (PrefAlign ? PrefAlignCost : 0);
+  }
+};
+
+} // end anonymous namespace
+
+/// \return size of function in .text: functions start at their alignment,
+/// so the next function with the same alignment starts at the aligned end
+static int64_t getPaddedSize(size_t Size, unsigned Alignment) {
+  return static_cast<int64_t>(alignTo(Size, Alignment));
+}
+
+/// Adds size of the created function \p F to \p Result. Its size is
+/// measured with both its own and preferred alignments
+static void addCreatedSize(const Function &F, size_t Size,
+                           const FunctionCompiler &Cost, MergeCost &Result) {
+  int64_t Padded = getPaddedSize(Size, Cost.getFunctionAlignment(F));
+  Result.NewSize += Padded;
+  Result.PrefAlignCost =
+      getPaddedSize(Size, Cost.getPrefFunctionAlignment(F)) - Padded;
+}
 
-static bool shouldReplaceCommonChoice(bool FuncCreated, Function *F,
-                                      const SmallVector<BBInfo, 8> &BBInfos,
-                                      FunctionCompiler &Cost) {
+static bool measureCommonChoice(bool FuncCreated, Function *F,
+                                ArrayRef<BBInfo> BBInfos,
+                                FunctionCompiler &Cost, MergeCost &Result) {
   SmallVector<StringRef, 16> Funcs;
 
   if (FuncCreated)
@@ -1103,26 +2129,36 @@ static bool shouldReplaceCommonChoice(bool FuncCreated, Function *F,
     return false;
   }
 
-  auto Results = getFunctionSizes(Cost.getObject(), Funcs);
+  auto Results = Cost.getFunctionSizes(Funcs);
   Cost.clearModule();
 
-  int SizeProfit = FuncCreated ? -Results.front() : 0;
-  for (size_t i = static_cast<size_t>(FuncCreated); i < Results.size();
-       i += 2) {
-    SizeProfit += Results[i] - Results[i + 1];
+  if (FuncCreated)
+    addCreatedSize(*F, Results.front(), Cost, Result);
+  // merged functions have the same alignment as original ones
+  size_t i = static_cast<size_t>(FuncCreated);
+  for (auto It = BBInfos.begin(), EIt = BBInfos.end(); It != EIt; i += 2) {
+    Function *Parent = It->getBB()->getParent();
+    unsigned Alignment = Cost.getFunctionAlignment(*Parent);
+    Result.OldSize += getPaddedSize(Results[i], Alignment);
+    Result.NewSize += getPaddedSize(Results[i + 1], Alignment);
+    do {
+      ++It;
+    } while (It != EIt && It->getBB()->getParent() == Parent);
   }
 
-  return SizeProfit > 0;
+  return true;
 }
 
-static bool shouldReplacePreciseChoice(bool FuncCreated, Function *Common,
-                                       const SmallVector<BBInfo, 8> &BBInfos,
-                                       FunctionCompiler &Cost) {
+static bool measurePreciseChoice(bool FuncCreated, Function *Common,
+                                 ArrayRef<BBInfo> BBInfos,
+                                 FunctionCompiler &Cost, MergeCost &Result) {
   // get current size of functions
   SmallVector<StringRef, 16> Funcs;
+  SmallVector<unsigned, 16> Alignments;
   for (auto It = BBInfos.begin(), EIt = BBInfos.end(); It != EIt;) {
     Function *LastF = It->getBB()->getParent();
     Funcs.push_back(LastF->getName());
+    Alignments.push_back(Cost.getFunctionAlignment(*LastF));
     Cost.cloneFunctionToInnerModule(*LastF);
     do {
       ++It;
@@ -1135,9 +2171,9 @@ static bool shouldReplacePreciseChoice(bool FuncCreated, Function *Common,
     return false;
   }
 
-  auto OldSizes = getFunctionSizes(Cost.getObject(), Funcs);
+  auto OldSizes = Cost.getFunctionSizes(Funcs);
 
-  size_t EHOldSize = getEHSize(Cost.getObject());
+  size_t EHOldSize = Cost.getEHSize();
   // we can't reuse the same functions because they are modified, when compiled
   // some instructions might be added
   Cost.clearModule();
@@ -1154,6 +2190,7 @@ static bool shouldReplacePreciseChoice(bool FuncCreated, Function *Common,
   }
 
   // clone and modify functions
+  OutputSlotMap Slots;
   for (auto It = BBInfos.begin(), EIt = BBInfos.end(); It != EIt;) {
     ArrayRef<BBInfo> InSameFunction =
         ArrayRef<BBInfo>(It, EIt).take_while([It](const BBInfo &I) -> bool {
@@ -1163,7 +2200,7 @@ static bool shouldReplacePreciseChoice(bool FuncCreated, Function *Common,
     for (auto &Info : InSameFunction) {
       BasicBlock *BB = Info.getBB();
       BB = getMappedBBofIdenticalFunctions(BB, NewF);
-      replaceBBInOtherFunction(NewCommon, Info, BB);
+      replaceBBInOtherFunction(NewCommon, Info, BB, Slots);
       ++It;
     }
   }
@@ -1173,59 +2210,378 @@ static bool shouldReplacePreciseChoice(bool FuncCreated, Function *Common,
     Cost.clearModule();
     return false;
   }
-  auto NewSizes = getFunctionSizes(Cost.getObject(), Funcs);
+  auto NewSizes = Cost.getFunctionSizes(Funcs);
 
-  size_t EHNewSize = getEHSize(Cost.getObject());
+  size_t EHNewSize = Cost.getEHSize();
   Cost.clearModule();
 
-  int SizeProfit = FuncCreated ? -NewSizes.back() : 0;
   for (size_t i = 0, ei = OldSizes.size(); i < ei; ++i) {
-    SizeProfit += OldSizes[i] - NewSizes[i];
+    Result.OldSize += getPaddedSize(OldSizes[i], Alignments[i]);
+    Result.NewSize += getPaddedSize(NewSizes[i], Alignments[i]);
   }
-  SizeProfit += EHOldSize - EHNewSize;
-  return SizeProfit > 0;
+  if (FuncCreated)
+    addCreatedSize(*Common, NewSizes.back(), Cost, Result);
+  Result.EHDelta = static_cast<int64_t>(EHOldSize) -
+                   static_cast<int64_t>(EHNewSize);
+  return true;
+}
+
+/// Size of an instruction of the basic cost for the fast estimate in bytes
+static const int64_t EstimatedInstSize = 4;
+
+/// Estimates sizes by target costs of instructions instead of compiling
+/// them. A call and every argument and output of it cost an instruction
+static void estimateReplace(bool FuncCreated, Function *F,
+                            ArrayRef<BBInfo> BBInfos,
+                            const TargetTransformInfo &TTI,
+                            MergeCost &Result) {
+  const BBInfo &Model = BBInfos.front();
+  int64_t MergedCost = 0;
+  size_t i = 0;
+  for (auto It = getBeginIt(Model.getBB()), EIt = getEndIt(Model.getBB());
+       It != EIt; ++It, ++i)
+    if (Model.getSpecial().isUsedInsideFunction(i))
+      MergedCost += TTI.getUserCost(&*It);
+
+  int64_t CreatedCost = 0;
+  if (FuncCreated)
+    for (const BasicBlock &BB : *F)
+      for (const Instruction &I : BB)
+        CreatedCost += TTI.getUserCost(&I);
+
+  int64_t CallCost = 1 + F->arg_size() + Model.getOutputs().size();
+  int64_t NumBBs = BBInfos.size();
+  Result.OldSize = NumBBs * MergedCost * EstimatedInstSize;
+  Result.NewSize = (NumBBs * CallCost + CreatedCost) * EstimatedInstSize;
+  Result.EHDelta = 0;
 }
 
-static bool shouldReplace(bool FuncCreated, Function *F,
-                          const SmallVector<BBInfo, 8> &BBInfos,
-                          FunctionCompiler &Cost) {
+/// Measures sizes of functions before and after merging
+/// \returns false if sizes can't be determined
+static bool measureReplace(bool FuncCreated, Function *F,
+                           ArrayRef<BBInfo> BBInfos,
+                           FunctionCompiler &Cost, MergeCost &Result) {
   AttributeSet FnAttr = F->getAttributes().getFnAttributes();
   // TODO: understand NoUnwind attribute
   if (FnAttr.hasFnAttribute(Attribute::NoUnwind))
-    return shouldReplaceCommonChoice(FuncCreated, F, BBInfos, Cost);
+    return measureCommonChoice(FuncCreated, F, BBInfos, Cost, Result);
   else
-    return shouldReplacePreciseChoice(FuncCreated, F, BBInfos, Cost);
+    return measurePreciseChoice(FuncCreated, F, BBInfos, Cost, Result);
+}
+
+/// Measures size of the function before and after sharing of its identical
+/// blocks \p BBs
+/// \returns false if sizes can't be determined
+static bool measureSharing(ArrayRef<BasicBlock *> BBs, FunctionCompiler &Cost,
+                           MergeCost &Result) {
+  Function *Parent = BBs.front()->getParent();
+  SmallVector<StringRef, 1> Funcs = {Parent->getName()};
+  unsigned Alignment = Cost.getFunctionAlignment(*Parent);
+
+  Cost.cloneFunctionToInnerModule(*Parent);
+  if (!Cost.compile()) {
+    DEBUG(dbgs() << "Can't determine module size\n");
+    Cost.clearModule();
+    return false;
+  }
+  size_t OldSize = Cost.getFunctionSizes(Funcs).front();
+  size_t EHOldSize = Cost.getEHSize();
+  Cost.clearModule();
+
+  Function *NewF = Cost.cloneFunctionToInnerModule(*Parent);
+  SmallVector<BasicBlock *, 4> NewBBs;
+  for (BasicBlock *BB : BBs)
+    NewBBs.push_back(getMappedBBofIdenticalFunctions(BB, NewF));
+  SharedBlocks Sharing;
+  bool Matched = Sharing.match(NewBBs);
+  assert(Matched && "Blocks of the cloned function must match");
+  (void)Matched;
+  Sharing.share();
+
+  if (!Cost.compile()) {
+    DEBUG(dbgs() << "Can't determine module size\n");
+    Cost.clearModule();
+    return false;
+  }
+  size_t NewSize = Cost.getFunctionSizes(Funcs).front();
+  size_t EHNewSize = Cost.getEHSize();
+  Cost.clearModule();
+
+  Result.OldSize = getPaddedSize(OldSize, Alignment);
+  Result.NewSize = getPaddedSize(NewSize, Alignment);
+  Result.EHDelta = static_cast<int64_t>(EHOldSize) -
+                   static_cast<int64_t>(EHNewSize);
+  return true;
+}
+
+/// Emits optimization remarks, describing the decision about the group
+/// \param Callee - function, that is called instead of \p BBInfos
+/// \param Shared - blocks share a copy instead of calling \p Callee
+/// \param Sizes - measured sizes or None, if the cost model wasn't run
+/// \param Reason - reason of rejection, empty if group is merged
+static void emitGroupRemarks(const BBsCommonInfo &CommonInfo,
+                             ArrayRef<BBInfo> BBInfos,
+                             const Function *Callee, bool FuncCreated,
+                             bool Shared, const Optional<MergeCost> &Sizes,
+                             StringRef Reason) {
+  const BBInfo &Model = BBInfos.front();
+  const Instruction *Loc = &*getBeginIt(Model.getBB());
+  OptimizationRemarkEmitter ORE(Model.getBB()->getParent(), nullptr);
+
+  OptimizationRemarkAnalysis Group(DEBUG_TYPE, "Group", Loc);
+  Group << "group of " << ore::NV("Members", BBInfos.size())
+        << " identical blocks with " << ore::NV("Inputs", Model.getInputs().size())
+        << " inputs and " << ore::NV("Outputs", CommonInfo.getOutputIds().size())
+        << " outputs;";
+  for (const BBInfo &Info : BBInfos) {
+    Group << " " << ore::NV("Function", Info.getBB()->getParent()->getName())
+          << ":" << ore::NV("Block", Info.getBB()->getName());
+  }
+  if (!FuncCreated)
+    Group << "; callee " << ore::NV("Callee", Callee->getName());
+  ORE.emit(Group);
+
+  auto AppendSizes = [&Sizes](DiagnosticInfoOptimizationBase &R) {
+    if (!Sizes)
+      return;
+    R << " (old size " << ore::NV("OldSize", Sizes->OldSize) << ", new size "
+      << ore::NV("NewSize", Sizes->NewSize) << ", EH delta "
+      << ore::NV("EHDelta", Sizes->EHDelta);
+    if (Sizes->PrefAlign)
+      R << ", preferred alignment costs "
+        << ore::NV("PrefAlignCost", Sizes->PrefAlignCost);
+    R << ")";
+  };
+
+  if (Reason.empty()) {
+    OptimizationRemark Merged(DEBUG_TYPE, "Merged", Loc);
+    if (Shared)
+      Merged << "shared " << ore::NV("Members", BBInfos.size())
+             << " blocks inside function";
+    else
+      Merged << "merged " << ore::NV("Members", BBInfos.size())
+             << " blocks into " << (FuncCreated ? "new" : "existing")
+             << " function";
+    AppendSizes(Merged);
+    ORE.emit(Merged);
+    return;
+  }
+
+  OptimizationRemarkMissed Missed(DEBUG_TYPE, "NotMerged", Loc);
+  Missed << "group of " << ore::NV("Members", BBInfos.size())
+         << " blocks not merged: " << ore::NV("Reason", Reason);
+  AppendSizes(Missed);
+  ORE.emit(Missed);
+}
+
+/// Measures sizes of functions \p Fs before and after sharing their tail of
+/// \p Length instructions
+static bool measureTail(ArrayRef<Function *> Fs, size_t Length,
+                        FunctionCompiler &Cost, MergeCost &Result) {
+  SmallVector<StringRef, 8> Funcs;
+  for (Function *F : Fs)
+    Funcs.push_back(F->getName());
+  auto GetPaddedSizes = [&](int64_t &Size) {
+    if (!Cost.compile()) {
+      DEBUG(dbgs() << "Can't determine module size\n");
+      Cost.clearModule();
+      return false;
+    }
+    SmallVector<size_t, 8> Sizes = Cost.getFunctionSizes(Funcs);
+    Size = 0;
+    for (size_t i = 0, ie = Funcs.size(); i < ie; ++i) {
+      // the created tail gets alignment of the model
+      Function *F = i < Fs.size() ? Fs[i] : Fs.front();
+      Size += getPaddedSize(Sizes[i], Cost.getFunctionAlignment(*F));
+    }
+    return true;
+  };
+
+  for (Function *F : Fs)
+    Cost.cloneFunctionToInnerModule(*F);
+  if (!GetPaddedSizes(Result.OldSize))
+    return false;
+  int64_t EHOldSize = Cost.getEHSize();
+  Cost.clearModule();
+
+  SmallVector<Function *, 8> NewFs;
+  for (Function *F : Fs)
+    NewFs.push_back(Cost.cloneFunctionToInnerModule(*F));
+  SharedTail Sharing;
+  bool Matched = Sharing.match(NewFs, Length);
+  assert(Matched && "Tails of cloned functions must match");
+  (void)Matched;
+  Function *Tail = Sharing.share("mergebb.tail");
+  if (!is_contained(NewFs, Tail))
+    Funcs.push_back(Tail->getName());
+  if (!GetPaddedSizes(Result.NewSize))
+    return false;
+  Result.EHDelta = EHOldSize - static_cast<int64_t>(Cost.getEHSize());
+  Cost.clearModule();
+  return true;
+}
+
+bool MergeBB::shareTails(Module &M) {
+  // candidates, which may have a tail of the minimal size in common
+  size_t MinLength = TailMinSize + 1;
+  MapVector<size_t, SmallVector<Function *, 4>> Buckets;
+  for (Function &F : M)
+    if (SharedTail::isCandidate(F) && F.front().size() >= MinLength)
+      Buckets[SharedTail::hashTail(F, MinLength)].push_back(&F);
+
+  bool Changed = false;
+  for (auto &Bucket : Buckets) {
+    SmallVectorImpl<Function *> &Candidates = Bucket.second;
+    while (Candidates.size() >= 2) {
+      Function *Model = Candidates.front();
+      SmallVector<std::pair<Function *, size_t>, 8> Lengths;
+      for (Function *F : makeArrayRef(Candidates).drop_front()) {
+        size_t Length = SharedTail::getCommonLength(*Model, *F);
+        if (Length >= MinLength)
+          Lengths.push_back(std::make_pair(F, Length));
+      }
+      std::stable_sort(Lengths.begin(), Lengths.end(),
+                       [](const std::pair<Function *, size_t> &L,
+                          const std::pair<Function *, size_t> &R) {
+                         return L.second > R.second;
+                       });
+
+      // longer tails save more for every function, shorter ones are shared
+      // by more functions
+      size_t Best = 0;
+      for (size_t k = 1, ke = Lengths.size(); k < ke; ++k)
+        if ((k + 1) * (Lengths[k].second - 1) >
+            (Best + 1) * (Lengths[Best].second - 1))
+          Best = k;
+
+      SmallVector<Function *, 8> Members = {Model};
+      for (size_t k = 0; k < Lengths.size() && k <= Best; ++k)
+        Members.push_back(Lengths[k].first);
+      size_t Length = Lengths.empty() ? 0 : Lengths[Best].second;
+      // a member, which is the whole tail, is called instead of a new one
+      auto Whole = find_if(Members, [Length](const Function *F) {
+        return F->front().size() == Length;
+      });
+      if (Whole != Members.end())
+        std::swap(*Whole, Members.front());
+
+      SharedTail Sharing;
+      MergeCost Measured;
+      if (Lengths.empty() || !Sharing.match(Members, Length) ||
+          !measureTail(Members, Length, *Cost, Measured) ||
+          Measured.getProfit() <= 0) {
+        Candidates.erase(Candidates.begin());
+        continue;
+      }
+
+      bool Created = !Sharing.isWholeModel();
+      Function *Tail = Sharing.share(FNamer->getName());
+      DEBUG(dbgs() << Members.size() << " functions share tail "
+                   << Tail->getName() << " of " << Length
+                   << " instructions, profit " << Measured.getProfit()
+                   << "\n");
+      TailCounter += Members.size() - !Created;
+      Changed = true;
+
+      // tails of created functions are placed by their callers too
+      if (Created || Placements.count(Tail)) {
+        bool Cold = all_of(Members, [this](Function *F) {
+          auto Found = Placements.find(F);
+          return Found != Placements.end() ? Found->second.Cold
+                                           : F->hasFnAttribute(Attribute::Cold);
+        });
+        CallerInfo &Info = Placements[Tail];
+        Info.Cold &= Cold;
+        for (Function *F : Members)
+          if (F != Tail)
+            Info.Weights[F] += 1;
+      }
+
+      Candidates.erase(remove_if(Candidates,
+                                 [&Members](Function *F) {
+                                   return is_contained(Members, F);
+                                 }),
+                       Candidates.end());
+    }
+  }
+  return Changed;
 }
 
+/// Group of identical blocks, measured for merging. Function, created for
+/// it, stays in the module until the plan is committed or discarded.
 /// Common steps of replacing equal basic blocks
 /// 1) Get common basic block info(inputs, outputs, ...)
 /// 2) Find suitable for merging function, or create if not found
 /// 3) Replace Basic blocks with factored out function.
-/// \param BBs array of equal basic blocks
-/// \return true if any BB was changed
-bool MergeBB::replace(const SmallVectorImpl<BasicBlock *> &BBs) {
-  assert(BBs.size() >= 2 && "No sence in merging");
-  assert(!skipFromMerging(BBs.front()) && "BB shouldn't be merged");
+/// measure() does the first two steps, commit() the last one
+struct MergeBB::MergePlan {
+  MergePlan(ArrayRef<BasicBlock *> BBs, const TargetTransformInfo &TTI,
+            GroupArena &Arena)
+      : CommonInfo(BBs, TTI, Arena) {}
+
+  /// \return profit of merging, if the group is merged by the cost model
+  int64_t getProfit() const {
+    return Reason.empty() && Sizes ? Sizes->getProfit() : 0;
+  }
+
+  BBsCommonInfo CommonInfo;
+  MutableArrayRef<BBInfo> BBInfos;
+  Function *F = nullptr;
+  bool FunctionCreated = false;
+  /// inputs, computed by the created function instead of callers
+  SmallVector<Instruction *, 4> Invariant;
+  Optional<MergeCost> Sizes;
+  /// reason of rejection, empty if the group is merged
+  StringRef Reason;
+  /// blocks of the same function share a copy instead of calls
+  SharedBlocks Sharing;
+  bool Share = false;
+  StringRef CreatedInfo;
+};
+
+/// \param Group array of equal basic blocks
+std::unique_ptr<MergeBB::MergePlan>
+MergeBB::measure(const SmallVectorImpl<BasicBlock *> &Group) {
+  assert(Group.size() >= 2 && "No sence in merging");
+  assert(!skipFromMerging(Group.front()) && "BB shouldn't be merged");
+
+  // calls, that were hot in the instrumented run, aren't created again
+  SmallVector<BasicBlock *, 16> BBs;
+  for (BasicBlock *BB : Group)
+    if (SiteProfile.empty() || SiteProfile.getCount(*BB) < HotCalls)
+      BBs.push_back(BB);
+  if (BBs.size() < 2) {
+    DEBUG(dbgs() << "Group of " << Group.size() << " blocks has hot sites\n");
+    return nullptr;
+  }
 
   auto &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(
       *BBs.front()->getParent());
 
-  BBsCommonInfo CommonInfo(BBs, TTI);
-
-  SmallVector<BBInfo, 8> BBInfos;
-  std::for_each(BBs.begin(), BBs.end(),
-                [&CommonInfo, &BBInfos](BasicBlock *BB) {
-                  BBInfos.emplace_back(BB, CommonInfo);
-                });
-  // we need to sort it to identify BBs, sharing the same functions
-  std::sort(BBInfos.begin(), BBInfos.end(),
-            [](const BBInfo &BBL, const BBInfo &BBR) {
-              return BBL.getBB()->getParent() < BBR.getBB()->getParent();
-            });
+  if (TimePassesIsEnabled)
+    AnalysisTimer.startTimer();
+
+  auto Plan = std::make_unique<MergePlan>(BBs, TTI, Arena);
+  BBsCommonInfo &CommonInfo = Plan->CommonInfo;
+
+  MutableArrayRef<BBInfo> BBInfos = Arena.allocate<BBInfo>(BBs.size());
+  for (size_t i = 0, ei = BBs.size(); i < ei; ++i)
+    new (&BBInfos[i]) BBInfo(BBs[i], CommonInfo);
+  // we need to sort it to identify BBs, sharing the same functions.
+  // Blocks come in module order, so functions are ordered by their first
+  // block instead of addresses to make the result reproducible
+  SmallDenseMap<const Function *, unsigned, 8> FunctionOrder;
+  for (const BBInfo &Info : BBInfos)
+    FunctionOrder.insert(std::make_pair(
+        Info.getBB()->getParent(), static_cast<unsigned>(FunctionOrder.size())));
+  std::stable_sort(BBInfos.begin(), BBInfos.end(),
+                   [&FunctionOrder](const BBInfo &BBL, const BBInfo &BBR) {
+                     return FunctionOrder.lookup(BBL.getBB()->getParent()) <
+                            FunctionOrder.lookup(BBR.getBB()->getParent());
+                   });
 
   Function *F = nullptr;
-  StringRef CreatedInfo;
-  DEBUG(CreatedInfo = "existed");
+  DEBUG(Plan->CreatedInfo = "existed");
 
   // Try to find suitable for merging function
   // If basic block has more, than 1 output, function can not be found
@@ -1237,8 +2593,8 @@ bool MergeBB::replace(const SmallVectorImpl<BasicBlock *> &BBs) {
       F = BBInfos[Id].getBB()->getParent();
 
       // remove BBInfos[Id] from replacing
-      BBInfos[Id] = std::move(BBInfos.back());
-      BBInfos.pop_back();
+      BBInfos[Id] = BBInfos.back();
+      BBInfos = BBInfos.drop_back();
 
       for (auto &Info : BBInfos) {
         Info.permutateInputs(Permuts);
@@ -1246,27 +2602,162 @@ bool MergeBB::replace(const SmallVectorImpl<BasicBlock *> &BBs) {
     }
   }
   bool FunctionCreated = F == nullptr;
+  // alternative of the created function with inputs over registers limit,
+  // passed in a struct
+  Function *Packed = nullptr;
+  SmallVectorImpl<Instruction *> &Invariant = Plan->Invariant;
   // if function was not found, create it
   if (FunctionCreated) {
     auto &Model = BBInfos.front();
 
-    F = createFuncFromBB(Model);
+    Invariant = sinkInvariantInputs(BBInfos);
+    size_t NumInputs = Model.getInputs().size();
+    F = createFuncFromBB(Model, Invariant, NumInputs, Arena);
     F->setName(FNamer->getName());
-    DEBUG(CreatedInfo = "created");
+    size_t NumRegisterInputs = getNumRegisterInputs(Model);
+    if (NumRegisterInputs != NumInputs) {
+      Packed = createFuncFromBB(Model, Invariant, NumRegisterInputs, Arena);
+      Packed->setName(FNamer->getName());
+    }
+    DEBUG(Plan->CreatedInfo = "created");
   }
   assert(F != nullptr && "Should not be reached");
 
-  if (!ForceMerge && !shouldReplace(FunctionCreated, F, BBInfos, *Cost)) {
-    if (FunctionCreated)
-      F->eraseFromParent();
+  if (TimePassesIsEnabled)
+    AnalysisTimer.stopTimer();
+
+  auto Measure = [&](bool Created, Function *Callee, MergeCost &Measured) {
+    if (!FastCost)
+      return measureReplace(Created, Callee, BBInfos, *Cost, Measured);
+    estimateReplace(Created, Callee, BBInfos, TTI, Measured);
+    return true;
+  };
+
+  Optional<MergeCost> &Sizes = Plan->Sizes;
+  StringRef &Reason = Plan->Reason;
+  if (!ForceMerge || DryRun) {
+    MergeCost Measured;
+    if (Measure(FunctionCreated, F, Measured))
+      Sizes = Measured;
+    else
+      Reason = "size can't be determined";
+  }
+  // stack arguments are usually more expensive than stores into the pack,
+  // so it is used without the cost model
+  if (Packed) {
+    bool UsePacked = ForceMerge && !DryRun;
+    MergeCost Measured;
+    if (!UsePacked && Measure(true, Packed, Measured) &&
+        (!Sizes || Measured.getProfit() > Sizes->getProfit())) {
+      UsePacked = true;
+      Sizes = Measured;
+      Reason = StringRef();
+    }
+    DEBUG(dbgs() << "Inputs of " << F->getName() << " are "
+                 << (UsePacked ? "packed" : "passed as arguments") << "\n");
+    if (UsePacked) {
+      Packed->takeName(F);
+      std::swap(F, Packed);
+    }
+    Packed->eraseFromParent();
+    --FunctionCounter;
+  }
+  // preferred alignment is given, if merging stays profitable with it
+  if (AlignCreated && Sizes && Sizes->PrefAlignCost > 0 &&
+      Sizes->getProfit() > Sizes->PrefAlignCost)
+    Sizes->PrefAlign = true;
+
+  // identical blocks of the same function may share a copy, that returns
+  // by switch, instead of calls and marshalling of outputs. The fast
+  // estimate doesn't compile them, so sharing is disabled with it
+  if (ShareBlocks && FunctionCreated && !FastCost) {
+    SmallVector<BasicBlock *, 4> Blocks;
+    for (const BBInfo &Info : BBInfos)
+      Blocks.push_back(Info.getBB());
+    if (Plan->Sharing.match(Blocks)) {
+      MergeCost Measured;
+      if (ForceMerge && !DryRun)
+        Plan->Share = true;
+      else if (Cost && measureSharing(Blocks, *Cost, Measured) &&
+               Measured.getProfit() > 0 &&
+               (!Sizes || Measured.getProfit() >= Sizes->getProfit())) {
+        Plan->Share = true;
+        Sizes = Measured;
+        Reason = StringRef();
+      }
+    }
+  }
+
+  if (!ForceMerge && Reason.empty() && Sizes->getProfit() <= 0)
+    Reason = "unprofitable";
+
+  Plan->BBInfos = BBInfos;
+  Plan->F = F;
+  Plan->FunctionCreated = FunctionCreated;
+  return Plan;
+}
+
+void MergeBB::discard(MergePlan &Plan) {
+  if (Plan.FunctionCreated) {
+    Plan.F->eraseFromParent();
+    --FunctionCounter;
+  }
+}
+
+/// \return true if any BB was changed
+bool MergeBB::commit(MergePlan &Plan) {
+  MutableArrayRef<BBInfo> BBInfos = Plan.BBInfos;
+  Function *F = Plan.F;
+  const Optional<MergeCost> &Sizes = Plan.Sizes;
+  StringRef Reason = Plan.Reason;
+
+  emitGroupRemarks(Plan.CommonInfo, BBInfos, F, Plan.FunctionCreated,
+                   Plan.Share, Sizes, Reason);
+
+  // forced groups are merged regardless of their profit, but are reported
+  // by it
+  ++Report.Groups;
+  if (Reason.empty() && Sizes && Sizes->getProfit() > 0) {
+    ++Report.Profitable;
+    Report.Profit += Sizes->getProfit();
+  }
+
+  if (DryRun || !Reason.empty()) {
+    discard(Plan);
     return false;
   }
 
-  for (auto &Info : BBInfos) {
-    replaceBBWithCall(Info, F);
+  if (Plan.Share) {
+    discard(Plan);
+    BasicBlock *SharedBB = Plan.Sharing.share();
+    SharedCounter += BBInfos.size();
+    ChangedFunctions.insert(SharedBB->getParent());
+    BlockWeights.erase(SharedBB->getParent());
+    DEBUG(dbgs() << "Number of basic blocks, sharing " << SharedBB->getName()
+                 << ": " << BBInfos.size() << "\n");
+    return true;
   }
 
-  DEBUG(dbgs() << "Number of basic blocks, replaced with " << CreatedInfo
+  if (Plan.FunctionCreated || Placements.count(F))
+    recordCallers(F, BBInfos);
+  InvariantInputCounter += Plan.Invariant.size();
+
+  for (size_t i = 0, ei = BBInfos.size(); i < ei; ++i) {
+    GlobalVariable *Counter =
+        Instrument ? SiteCounters.addSite(*BBInfos[i].getBB(), *F) : nullptr;
+    BasicBlock *Replaced = BBInfos[i].getBB();
+    replaceBBWithCall(BBInfos[i], F, OutputSlots, Counter);
+    moveBlockWeight(Replaced, BBInfos[i].getBB());
+    ChangedFunctions.insert(BBInfos[i].getBB()->getParent());
+  }
+  if (Plan.FunctionCreated)
+    ChangedFunctions.insert(F);
+  // created functions are optimized for size, so preferred alignment isn't
+  // applied by code generator without explicit one
+  if (Sizes && Sizes->PrefAlign)
+    F->setAlignment(Cost->getPrefFunctionAlignment(*F));
+
+  DEBUG(dbgs() << "Number of basic blocks, replaced with " << Plan.CreatedInfo
                << " function " << F->getName() << ": " << BBInfos.size()
                << "\n");
   debugPrint(BBInfos.front().getBB(), "", false);
@@ -1274,4 +2765,79 @@ bool MergeBB::replace(const SmallVectorImpl<BasicBlock *> &BBs) {
   DEBUG(dbgs() << "\n");
 
   return true;
-}
\ No newline at end of file
+}
+
+bool MergeBB::replace(const SmallVectorImpl<BasicBlock *> &Group) {
+  std::unique_ptr<MergePlan> Plan = measure(Group);
+  return Plan && commit(*Plan);
+}
+
+bool MergeBB::replaceGroup(const SmallVectorImpl<BasicBlock *> &Group) {
+  if (!SplitOutputs)
+    return replace(Group);
+
+  // outputs -> members with these outputs in order of the group
+  using OutputVariant =
+      std::pair<SmallVector<size_t, 8>, SmallVector<BasicBlock *, 16>>;
+  SmallVector<OutputVariant, 4> Variants;
+  for (BasicBlock *BB : Group) {
+    SmallVector<size_t, 8> Outputs = getOutput(BB);
+    auto It = find_if(Variants, [&Outputs](const OutputVariant &Variant) {
+      return Variant.first == Outputs;
+    });
+    if (It == Variants.end()) {
+      Variants.push_back(OutputVariant(std::move(Outputs), {}));
+      It = std::prev(Variants.end());
+    }
+    It->second.push_back(BB);
+  }
+  if (Variants.size() == 1)
+    return replace(Group);
+
+  if (ForceMerge && !DryRun) {
+    bool Split = all_of(Variants, [](const OutputVariant &Variant) {
+      return Variant.second.size() >= 2;
+    });
+    if (!Split)
+      return replace(Group);
+    ++SplitGroupCounter;
+    bool Changed = false;
+    for (const OutputVariant &Variant : Variants)
+      Changed |= replace(Variant.second);
+    return Changed;
+  }
+
+  // the union and the variants are measured once, and the chosen plans are
+  // committed with their sizes. Members without a pair stay unmerged
+  // after splitting, so they add no profit to it
+  std::unique_ptr<MergePlan> Union = measure(Group);
+  int64_t UnionProfit = Union ? Union->getProfit() : 0;
+  SmallVector<std::unique_ptr<MergePlan>, 4> Parts;
+  int64_t SplitProfit = 0;
+  for (const OutputVariant &Variant : Variants) {
+    if (Variant.second.size() < 2)
+      continue;
+    if (std::unique_ptr<MergePlan> Part = measure(Variant.second)) {
+      SplitProfit += Part->getProfit();
+      Parts.push_back(std::move(Part));
+    }
+  }
+  bool Split = SplitProfit > UnionProfit;
+  DEBUG(dbgs() << "Group of " << Group.size() << " blocks has "
+               << Variants.size() << " output variants, profit "
+               << SplitProfit << " vs " << UnionProfit << " of union\n");
+
+  if (!Split) {
+    for (std::unique_ptr<MergePlan> &Part : Parts)
+      discard(*Part);
+    return Union && commit(*Union);
+  }
+
+  if (Union)
+    discard(*Union);
+  ++SplitGroupCounter;
+  bool Changed = false;
+  for (std::unique_ptr<MergePlan> &Part : Parts)
+    Changed |= commit(*Part);
+  return Changed;
+}
@@ -0,0 +1,57 @@
+//===-- MergeBB.h - Merge identical basic blocks ----------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file contains interface for running MergeBB pass outside of opt and
+/// for embedding it into other programs (see also MergeBBLayer.h for JIT)
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMTRANSFORM_MERGEBB_H
+#define LLVMTRANSFORM_MERGEBB_H
+
+#include <atomic>
+
+namespace llvm {
+
+class BasicBlock;
+class Module;
+class ModulePass;
+class TargetMachine;
+
+/// Options of the pass, which embedders set instead of the command line.
+/// Command line options still apply
+struct MergeBBOptions {
+  /// Estimate sizes by target costs of instructions instead of compiling
+  /// candidates. It is much faster, but less precise, and disables sharing of
+  /// blocks and tails, which needs compilation
+  bool FastCost = false;
+  /// Seconds, after which merging stops and blocks, merged so far, are kept.
+  /// 0 means no deadline
+  unsigned Deadline = 0;
+  /// Merging stops, when the flag is set, e.g. by another thread
+  const std::atomic<bool> *Cancel = nullptr;
+};
+
+/// Creates pass, that merges identical basic blocks
+ModulePass *createMergeBBPass();
+ModulePass *createMergeBBPass(const MergeBBOptions &Options);
+
+/// Merges identical basic blocks of \p M with costs of target \p TM or with
+/// default costs, if it is null
+/// \return whether \p M was changed
+bool mergeBasicBlocks(Module &M, TargetMachine *TM,
+                      const MergeBBOptions &Options = MergeBBOptions());
+
+/// \return true if \p BB is not considered for merging at all
+bool skipFromMerging(const BasicBlock *BB);
+
+} // namespace llvm
+
+#endif // LLVMTRANSFORM_MERGEBB_H
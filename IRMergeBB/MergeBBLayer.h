@@ -0,0 +1,54 @@
+//===-- MergeBBLayer.h - ORC layer, merging basic blocks --------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file contains ORC layer, which merges identical basic blocks of every
+/// added module before it is passed to the base layer (usually the compile
+/// one). Near-duplicate code of JIT-ed modules takes less code memory then.
+/// The fast cost estimate keeps latency of adding modules low:
+///
+///   MergeBBLayer<decltype(CompileLayer)> MergeLayer(
+///       CompileLayer, MergeBBTransform(TM, Options));
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMTRANSFORM_MERGEBBLAYER_H
+#define LLVMTRANSFORM_MERGEBBLAYER_H
+
+#include "MergeBB.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/IR/Module.h"
+#include <memory>
+
+namespace llvm {
+
+/// Transform of IRTransformLayer, which merges identical basic blocks
+class MergeBBTransform {
+public:
+  MergeBBTransform(TargetMachine *TM = nullptr,
+                   MergeBBOptions Options = MergeBBOptions())
+      : TM(TM), Options(Options) {}
+
+  std::shared_ptr<Module> operator()(std::shared_ptr<Module> M) {
+    mergeBasicBlocks(*M, TM, Options);
+    return M;
+  }
+
+private:
+  TargetMachine *TM;
+  MergeBBOptions Options;
+};
+
+/// Layer, which merges identical basic blocks of added modules
+template <typename BaseLayerT>
+using MergeBBLayer = orc::IRTransformLayer<BaseLayerT, MergeBBTransform>;
+
+} // namespace llvm
+
+#endif // LLVMTRANSFORM_MERGEBBLAYER_H
@@ -0,0 +1,129 @@
+//===-- Progress.cpp - Progress and cancellation of merging ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Signal handler only sets a flag, which is polled between groups. Handlers
+/// are installed for the run of the pass and reset to the previous ones by
+/// the first signal, so a repeated signal isn't delayed. Remaining time is
+/// extrapolated from the speed of the current round.
+///
+//===----------------------------------------------------------------------===//
+
+#include "Progress.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/raw_ostream.h"
+
+#ifdef LLVM_ON_UNIX
+#include <signal.h>
+#endif
+
+using namespace llvm;
+
+#ifdef LLVM_ON_UNIX
+static volatile sig_atomic_t SignalReceived = 0;
+static const int CancelSignals[] = {SIGINT, SIGTERM};
+static struct sigaction PrevActions[array_lengthof(CancelSignals)];
+
+static void cancelBySignal(int Signal) {
+  SignalReceived = 1;
+  for (size_t i = 0; i < array_lengthof(CancelSignals); ++i)
+    sigaction(CancelSignals[i], &PrevActions[i], nullptr);
+}
+#endif
+
+void MergeProgress::start(unsigned Interval, unsigned Deadline,
+                          const std::atomic<bool> *Cancel, bool OnSignal) {
+  Clock::time_point Now = Clock::now();
+  this->Interval = Interval;
+  this->Cancel = Cancel;
+  HasDeadline = Deadline != 0;
+  this->Deadline = Now + std::chrono::seconds(Deadline);
+  NextReport = Now + std::chrono::seconds(Interval);
+  RoundStart = Now;
+  Round = 0;
+  Groups = Done = 0;
+  Saved = 0;
+  CancelReason = nullptr;
+
+#ifdef LLVM_ON_UNIX
+  HandlesSignals = OnSignal;
+  if (!HandlesSignals)
+    return;
+  SignalReceived = 0;
+  struct sigaction Action;
+  Action.sa_handler = cancelBySignal;
+  Action.sa_flags = 0;
+  sigemptyset(&Action.sa_mask);
+  for (size_t i = 0; i < array_lengthof(CancelSignals); ++i)
+    sigaction(CancelSignals[i], &Action, &PrevActions[i]);
+#endif
+}
+
+void MergeProgress::startRound(unsigned Round, size_t Groups) {
+  this->Round = Round;
+  this->Groups = Groups;
+  Done = 0;
+  RoundStart = Clock::now();
+}
+
+void MergeProgress::groupDone(int64_t Saved) {
+  ++Done;
+  this->Saved = Saved;
+  if (Interval == 0)
+    return;
+  // the end of every round is reported as well
+  Clock::time_point Now = Clock::now();
+  if (Now < NextReport && Done != Groups)
+    return;
+  NextReport = Now + std::chrono::seconds(Interval);
+  report();
+}
+
+void MergeProgress::report() {
+  using Seconds = std::chrono::duration<double>;
+  double Elapsed = Seconds(Clock::now() - RoundStart).count();
+  errs() << "MergeBB progress: round " << Round + 1 << ", " << Done << " of "
+         << Groups << " groups, saved " << Saved << " bytes";
+  if (Done != 0 && Done < Groups)
+    errs() << ", about "
+           << static_cast<uint64_t>(Elapsed / Done * (Groups - Done))
+           << " s left";
+  errs() << "\n";
+}
+
+bool MergeProgress::isCancelled() {
+  if (CancelReason)
+    return true;
+  if (Cancel && Cancel->load(std::memory_order_relaxed))
+    CancelReason = "request";
+  else if (HasDeadline && Clock::now() >= Deadline)
+    CancelReason = "deadline";
+#ifdef LLVM_ON_UNIX
+  else if (HandlesSignals && SignalReceived)
+    CancelReason = "signal";
+#endif
+  return CancelReason != nullptr;
+}
+
+void MergeProgress::finish() {
+#ifdef LLVM_ON_UNIX
+  // handlers are already reset, if the signal was received
+  if (HandlesSignals && !SignalReceived) {
+    for (size_t i = 0; i < array_lengthof(CancelSignals); ++i)
+      sigaction(CancelSignals[i], &PrevActions[i], nullptr);
+  }
+  HandlesSignals = false;
+#endif
+  if (CancelReason) {
+    errs() << "MergeBB: merging is cancelled by " << CancelReason
+           << " in round " << Round + 1 << " after " << Done << " of "
+           << Groups << " groups, saved " << Saved << " bytes\n";
+  }
+}
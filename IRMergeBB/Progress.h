@@ -0,0 +1,77 @@
+//===-- Progress.h - Progress and cancellation of merging -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file contains periodic progress report of long runs of the pass and
+/// their cooperative cancellation by a deadline, a flag or a signal
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMTRANSFORM_PROGRESS_H
+#define LLVMTRANSFORM_PROGRESS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace llvm {
+
+/// Progress of merging groups of identical blocks. Cancellation is checked
+/// only between groups, so the module is always left valid, with groups,
+/// merged before cancellation
+class MergeProgress {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// Starts measuring time of the run
+  /// \param Interval - seconds between reports, 0 disables them
+  /// \param Deadline - seconds after the start, when merging is cancelled,
+  /// 0 means no deadline
+  /// \param Cancel - flag, which cancels merging, when it is set
+  /// \param OnSignal - cancel merging by the first SIGINT or SIGTERM. The next
+  /// one terminates the process as usual
+  void start(unsigned Interval, unsigned Deadline,
+             const std::atomic<bool> *Cancel, bool OnSignal);
+
+  /// Starts a round of merging \p Groups groups
+  void startRound(unsigned Round, size_t Groups);
+
+  /// Accounts a processed group. \p Saved is the total number of bytes,
+  /// saved so far. Progress is reported, if the interval has passed or the
+  /// round is finished
+  void groupDone(int64_t Saved);
+
+  /// \return true, if merging should stop. Reason is reported once
+  bool isCancelled();
+
+  /// Restores signal handlers and reports the result of cancelled run
+  void finish();
+
+private:
+  void report();
+
+  unsigned Interval = 0;
+  const std::atomic<bool> *Cancel = nullptr;
+  bool HandlesSignals = false;
+  bool HasDeadline = false;
+  Clock::time_point Deadline;
+  Clock::time_point RoundStart;
+  Clock::time_point NextReport;
+
+  unsigned Round = 0;
+  size_t Groups = 0;
+  size_t Done = 0;
+  int64_t Saved = 0;
+  const char *CancelReason = nullptr;
+};
+
+} // namespace llvm
+
+#endif // LLVMTRANSFORM_PROGRESS_H
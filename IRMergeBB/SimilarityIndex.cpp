@@ -0,0 +1,161 @@
+//===-- SimilarityIndex.cpp - Index of similar basic blocks ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Every block is a set of n-grams of (opcode, type) tokens of its merged
+/// part. MinHash signature estimates Jaccard similarity of these sets and
+/// its bands are buckets of locality-sensitive hashing: blocks with
+/// similarity s share a band with probability 1 - (1 - s^Rows)^Bands.
+///
+//===----------------------------------------------------------------------===//
+
+#include "SimilarityIndex.h"
+#include "Utilities.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/IntEqClasses.h"
+#include "llvm/ADT/STLExtras.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "similarityindex"
+
+/// Members of buckets larger than this are compared with at most this number
+/// of representatives instead of all pairs
+static const size_t MaxPairwiseBucket = 32;
+
+static uint64_t mix(uint64_t L, uint64_t R) {
+  return hashing::detail::hash_16_bytes(L, R);
+}
+
+static uint64_t getToken(const Instruction &I) {
+  Type *T = I.getType();
+  uint64_t TypeKey = T->getTypeID();
+  if (T->isIntegerTy())
+    TypeKey = mix(TypeKey, T->getIntegerBitWidth());
+  return mix(I.getOpcode(), mix(TypeKey, I.getNumOperands()));
+}
+
+SimilarityIndex::BlockId SimilarityIndex::insert(const BasicBlock &BB) {
+  SmallVector<uint64_t, 32> Tokens;
+  for (auto I = utilities::getBeginIt(&BB), IE = utilities::getEndIt(&BB);
+       I != IE; ++I)
+    Tokens.push_back(getToken(*I));
+
+  // n-grams of tokens; short blocks consist of the single one
+  SmallVector<uint64_t, 32> Grams;
+  size_t GramsNum = Tokens.size() < GramSize ? 1 : Tokens.size() - GramSize + 1;
+  for (size_t i = 0; i < GramsNum; ++i) {
+    uint64_t Gram = 0;
+    for (size_t j = i, je = std::min<size_t>(i + GramSize, Tokens.size());
+         j < je; ++j)
+      Gram = mix(Gram, Tokens[j]);
+    Grams.push_back(Gram);
+  }
+
+  BlockId Id = Blocks.size();
+  Blocks.push_back(&BB);
+  size_t Begin = Signatures.size();
+  for (unsigned k = 0; k < SignatureSize; ++k) {
+    uint64_t Min = ~0ULL;
+    for (uint64_t Gram : Grams)
+      Min = std::min(Min, mix(Gram, k));
+    Signatures.push_back(Min);
+  }
+
+  for (unsigned b = 0; b < Bands; ++b) {
+    uint64_t Band = b;
+    for (unsigned r = 0; r < Rows; ++r)
+      Band = mix(Band, Signatures[Begin + b * Rows + r]);
+    Buckets[Band].push_back(Id);
+  }
+  return Id;
+}
+
+double SimilarityIndex::getSimilarity(BlockId L, BlockId R) const {
+  ArrayRef<uint64_t> SL = getSignature(L);
+  ArrayRef<uint64_t> SR = getSignature(R);
+  unsigned Equal = 0;
+  for (unsigned k = 0; k < SignatureSize; ++k)
+    Equal += SL[k] == SR[k];
+  return static_cast<double>(Equal) / SignatureSize;
+}
+
+SmallVector<SimilarityIndex::BlockId, 8>
+SimilarityIndex::query(BlockId Id) const {
+  ArrayRef<uint64_t> S = getSignature(Id);
+  SmallVector<BlockId, 8> Result;
+  for (unsigned b = 0; b < Bands; ++b) {
+    uint64_t Band = b;
+    for (unsigned r = 0; r < Rows; ++r)
+      Band = mix(Band, S[b * Rows + r]);
+    auto Found = Buckets.find(Band);
+    if (Found == Buckets.end())
+      continue;
+    for (BlockId Other : Found->second)
+      if (Other != Id)
+        Result.push_back(Other);
+  }
+  std::sort(Result.begin(), Result.end());
+  Result.erase(std::unique(Result.begin(), Result.end()), Result.end());
+  return Result;
+}
+
+std::vector<SmallVector<SimilarityIndex::BlockId, 4>>
+SimilarityIndex::getClusters(double Threshold) const {
+  IntEqClasses Classes(Blocks.size());
+  auto Link = [&](BlockId L, BlockId R) {
+    if (getSimilarity(L, R) >= Threshold)
+      Classes.join(L, R);
+  };
+
+  for (const auto &Bucket : Buckets) {
+    ArrayRef<BlockId> Members = Bucket.second;
+    if (Members.size() > MaxPairwiseBucket) {
+      // every member joins the first similar representative or becomes one,
+      // so a dissimilar neighbour doesn't split a cluster
+      SmallVector<BlockId, MaxPairwiseBucket> Representatives;
+      for (BlockId Member : Members) {
+        auto Similar = find_if(Representatives, [&](BlockId Representative) {
+          return getSimilarity(Member, Representative) >= Threshold;
+        });
+        if (Similar != Representatives.end())
+          Classes.join(*Similar, Member);
+        else if (Representatives.size() < MaxPairwiseBucket)
+          Representatives.push_back(Member);
+      }
+      continue;
+    }
+    for (size_t i = 0, ie = Members.size(); i < ie; ++i)
+      for (size_t j = i + 1; j < ie; ++j)
+        Link(Members[i], Members[j]);
+  }
+  Classes.compress();
+
+  std::vector<SmallVector<BlockId, 4>> Result(Classes.getNumClasses());
+  for (BlockId Id = 0, E = Blocks.size(); Id < E; ++Id)
+    Result[Classes[Id]].push_back(Id);
+
+  Result.erase(std::remove_if(Result.begin(), Result.end(),
+                              [](const SmallVectorImpl<BlockId> &C) {
+                                return C.size() < 2;
+                              }),
+               Result.end());
+  std::stable_sort(Result.begin(), Result.end(),
+                   [](const SmallVectorImpl<BlockId> &L,
+                      const SmallVectorImpl<BlockId> &R) {
+                     return L.size() > R.size();
+                   });
+  return Result;
+}
+
+void SimilarityIndex::clear() {
+  Blocks.clear();
+  Signatures.clear();
+  Buckets.clear();
+}
@@ -0,0 +1,71 @@
+//===-- SimilarityIndex.h - Index of similar basic blocks -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file contains locality-sensitive index of basic blocks, that finds
+/// blocks, which differ by few instructions
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMTRANSFORM_SIMILARITYINDEX_H
+#define LLVMTRANSFORM_SIMILARITYINDEX_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include <unordered_map>
+#include <vector>
+
+namespace llvm {
+
+class BasicBlock;
+
+/// MinHash signatures of opcode/type n-grams of blocks, split into bands.
+/// Blocks with the same band are candidates to be similar, so querying
+/// doesn't depend on number of blocks in the index
+class SimilarityIndex {
+public:
+  enum { Bands = 16, Rows = 4, SignatureSize = Bands * Rows };
+  /// Length of n-grams of instructions
+  enum { GramSize = 3 };
+
+  typedef unsigned BlockId;
+
+  BlockId insert(const BasicBlock &BB);
+
+  const BasicBlock *getBlock(BlockId Id) const { return Blocks[Id]; }
+
+  size_t size() const { return Blocks.size(); }
+
+  /// \return estimated Jaccard similarity of n-grams of blocks
+  double getSimilarity(BlockId L, BlockId R) const;
+
+  /// \return blocks, which share at least one band with \p Id
+  SmallVector<BlockId, 8> query(BlockId Id) const;
+
+  /// \return clusters of at least 2 blocks, connected by pairs with
+  /// similarity not less than \p Threshold. Clusters are sorted by size
+  std::vector<SmallVector<BlockId, 4>> getClusters(double Threshold) const;
+
+  void clear();
+
+private:
+  ArrayRef<uint64_t> getSignature(BlockId Id) const {
+    return makeArrayRef(Signatures).slice(Id * SignatureSize, SignatureSize);
+  }
+
+  std::vector<const BasicBlock *> Blocks;
+  /// Signatures of all blocks one by one
+  std::vector<uint64_t> Signatures;
+  /// Band hash -> blocks with this band
+  std::unordered_map<uint64_t, SmallVector<BlockId, 4>> Buckets;
+};
+
+} // namespace llvm
+
+#endif // LLVMTRANSFORM_SIMILARITYINDEX_H
@@ -0,0 +1,163 @@
+//===-- SiteProfile.cpp - Counters of calls of created functions ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Counters are incremented by relaxed atomics, so instrumented programs
+/// may be multithreaded. Table of a module has the layout of MergeBBTable of
+/// the runtime: number of sites, counters, names of sites and a link to the
+/// next registered table.
+///
+//===----------------------------------------------------------------------===//
+
+#include "SiteProfile.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "siteprofile"
+
+/// \return name of \p BB, or its index, if it isn't named
+static std::string getBlockName(const BasicBlock &BB) {
+  if (BB.hasName())
+    return BB.getName();
+  size_t Index = 0;
+  for (const BasicBlock &Other : *BB.getParent()) {
+    if (&Other == &BB)
+      break;
+    ++Index;
+  }
+  return "#" + std::to_string(Index);
+}
+
+std::string llvm::getCallSiteName(const BasicBlock &BB) {
+  return (BB.getParent()->getName() + "\t" + getBlockName(BB)).str();
+}
+
+GlobalVariable *CallSiteCounters::addSite(const BasicBlock &BB,
+                                          const Function &Callee) {
+  Module &M = *const_cast<Module *>(BB.getModule());
+  Type *Int64Ty = Type::getInt64Ty(M.getContext());
+  auto *Counter = new GlobalVariable(M, Int64Ty, false,
+                                     GlobalValue::PrivateLinkage,
+                                     ConstantInt::get(Int64Ty, 0),
+                                     "mergebb.site");
+  Sites.push_back({Counter, BB.getParent()->getName(), getBlockName(BB),
+                   Callee.getName()});
+  return Counter;
+}
+
+void CallSiteCounters::finalize(Module &M) {
+  if (Sites.empty())
+    return;
+
+  LLVMContext &Context = M.getContext();
+  Type *VoidTy = Type::getVoidTy(Context);
+  IntegerType *Int64Ty = Type::getInt64Ty(Context);
+  PointerType *Int8PtrTy = Type::getInt8PtrTy(Context);
+  Constant *Zeros[] = {ConstantInt::get(Int64Ty, 0),
+                       ConstantInt::get(Int64Ty, 0)};
+
+  ArrayType *CountersTy = ArrayType::get(Int64Ty, Sites.size());
+  auto *Counters = new GlobalVariable(M, CountersTy, false,
+                                      GlobalValue::PrivateLinkage,
+                                      Constant::getNullValue(CountersTy),
+                                      "mergebb.counters");
+
+  StringMap<Constant *> Strings;
+  auto GetString = [&](StringRef S) {
+    Constant *&Str = Strings[S];
+    if (!Str) {
+      Constant *Data = ConstantDataArray::getString(Context, S);
+      auto *GV = new GlobalVariable(M, Data->getType(), true,
+                                    GlobalValue::PrivateLinkage, Data,
+                                    "mergebb.name");
+      GV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+      Str = ConstantExpr::getPointerCast(GV, Int8PtrTy);
+    }
+    return Str;
+  };
+
+  // placeholders become elements of the counters array
+  StructType *SiteTy =
+      StructType::get(Context, {Int8PtrTy, Int8PtrTy, Int8PtrTy});
+  SmallVector<Constant *, 16> Entries;
+  for (size_t i = 0, ie = Sites.size(); i < ie; ++i) {
+    const Site &S = Sites[i];
+    Constant *Indices[] = {ConstantInt::get(Int64Ty, 0),
+                           ConstantInt::get(Int64Ty, i)};
+    S.Counter->replaceAllUsesWith(
+        ConstantExpr::getInBoundsGetElementPtr(CountersTy, Counters, Indices));
+    S.Counter->eraseFromParent();
+    Entries.push_back(ConstantStruct::get(
+        SiteTy, {GetString(S.Caller), GetString(S.Block), GetString(S.Callee)}));
+  }
+  Sites.clear();
+
+  ArrayType *SitesTy = ArrayType::get(SiteTy, Entries.size());
+  auto *SiteTable = new GlobalVariable(M, SitesTy, true,
+                                       GlobalValue::PrivateLinkage,
+                                       ConstantArray::get(SitesTy, Entries),
+                                       "mergebb.sites");
+
+  StructType *TableTy = StructType::get(
+      Context, {Int64Ty, Int64Ty->getPointerTo(), SiteTy->getPointerTo(),
+                Int8PtrTy});
+  Constant *Fields[] = {
+      ConstantInt::get(Int64Ty, Entries.size()),
+      ConstantExpr::getInBoundsGetElementPtr(CountersTy, Counters, Zeros),
+      ConstantExpr::getInBoundsGetElementPtr(SitesTy, SiteTable, Zeros),
+      ConstantPointerNull::get(Int8PtrTy)};
+  // the runtime links tables of modules through the last field
+  auto *Table = new GlobalVariable(M, TableTy, false,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantStruct::get(TableTy, Fields),
+                                   "mergebb.table");
+
+  Constant *Register = M.getOrInsertFunction(
+      "__mergebb_register", FunctionType::get(VoidTy, {Int8PtrTy}, false));
+  Function *Ctor =
+      Function::Create(FunctionType::get(VoidTy, false),
+                       GlobalValue::InternalLinkage, "mergebb.register", &M);
+  IRBuilder<> Builder(BasicBlock::Create(Context, "", Ctor));
+  Builder.CreateCall(Register, ConstantExpr::getPointerCast(Table, Int8PtrTy));
+  Builder.CreateRetVoid();
+  appendToGlobalCtors(M, Ctor, 0);
+}
+
+bool CallSiteProfile::load(StringRef FileName, std::string &Error) {
+  auto Buffer = MemoryBuffer::getFile(FileName);
+  if (!Buffer) {
+    Error = Buffer.getError().message();
+    return false;
+  }
+
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    SmallVector<StringRef, 4> Fields;
+    Line.rtrim('\r').split(Fields, '\t');
+    uint64_t Count;
+    if (Fields.size() != 4 || Fields[0].getAsInteger(10, Count)) {
+      Error = ("malformed line '" + Line + "'").str();
+      return false;
+    }
+    Counts[(Fields[1] + "\t" + Fields[2]).str()] += Count;
+  }
+  return true;
+}
+
+uint64_t CallSiteProfile::getCount(const BasicBlock &BB) const {
+  return Counts.lookup(getCallSiteName(BB));
+}
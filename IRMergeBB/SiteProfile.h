@@ -0,0 +1,75 @@
+//===-- SiteProfile.h - Counters of calls of created functions --*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file contains instrumentation of calls, that replace merged blocks,
+/// and reading of counters, dumped by the runtime (runtime/mergebb_rt.c)
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMTRANSFORM_SITEPROFILE_H
+#define LLVMTRANSFORM_SITEPROFILE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+class BasicBlock;
+class Function;
+class GlobalVariable;
+class Module;
+
+/// Call site is a replaced block: its function and its name or index, if
+/// the block isn't named
+std::string getCallSiteName(const BasicBlock &BB);
+
+/// Counters of instrumented call sites. Every site gets a placeholder
+/// counter, and finalize() puts all counters of the module into an array.
+/// The module registers the array and the table of sites in the runtime by
+/// a constructor, and the runtime dumps them at exit as lines
+/// "count<TAB>caller<TAB>block<TAB>callee"
+class CallSiteCounters {
+public:
+  /// \return i64 counter of the call of \p Callee, that replaces \p BB
+  GlobalVariable *addSite(const BasicBlock &BB, const Function &Callee);
+
+  /// Creates the counters array, the table of sites and its registration
+  void finalize(Module &M);
+
+private:
+  struct Site {
+    GlobalVariable *Counter;
+    std::string Caller, Block, Callee;
+  };
+  std::vector<Site> Sites;
+};
+
+/// Executions of call sites, read from dumps of the runtime
+class CallSiteProfile {
+public:
+  /// Reads dump \p FileName. Counts of the same site are summed, so dumps
+  /// of several runs may be concatenated
+  /// \return false and sets \p Error, if the file can't be read or parsed
+  bool load(StringRef FileName, std::string &Error);
+
+  bool empty() const { return Counts.empty(); }
+
+  /// \return number of executions of the call, that replaced \p BB
+  uint64_t getCount(const BasicBlock &BB) const;
+
+private:
+  StringMap<uint64_t> Counts;
+};
+
+} // namespace llvm
+
+#endif // LLVMTRANSFORM_SITEPROFILE_H
@@ -7,6 +7,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ValueSymbolTable.h"
 #include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/Endian.h"
 #include <llvm/Object/SymbolSize.h>
 
 namespace llvm {
@@ -83,5 +84,34 @@ size_t getEHSize(const object::ObjectFile &F) {
   return 0;
 }
 
+size_t getCIESize(const object::ObjectFile &F) {
+  for (auto S : F.sections()) {
+    StringRef SR;
+    if (S.getName(SR) || SR != ".eh_frame")
+      continue;
+    StringRef Contents;
+    if (S.getContents(Contents))
+      return 0;
+    auto Read32 = [&F, Contents](size_t Offset) {
+      const char *Data = Contents.data() + Offset;
+      return F.isLittleEndian() ? support::endian::read32le(Data)
+                                : support::endian::read32be(Data);
+    };
+    size_t Result = 0;
+    for (size_t Offset = 0; Offset + 8 <= Contents.size();) {
+      // records are length, CIE id (0 for CIEs) and the rest. Zero length
+      // terminates the section, 64-bit records aren't emitted by LLVM
+      uint32_t Length = Read32(Offset);
+      if (Length == 0 || Length == 0xffffffff)
+        break;
+      if (Read32(Offset + 4) == 0)
+        Result += Length + 4;
+      Offset += Length + 4;
+    }
+    return Result;
+  }
+  return 0;
+}
+
 } // namespace utilities
 } // namespace llvm
\ No newline at end of file
@@ -2,7 +2,10 @@
 #define LLVMTRANSFORM_UTILITIES_H
 
 #include "CompareBB.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/Error.h"
 
 namespace llvm {
@@ -24,34 +27,49 @@ inline BasicBlock::const_iterator getEndIt(const BasicBlock *BB) {
   return std::prev(BB->end());
 }
 
+/// \return whether \p I precedes the merged part of its block: PHI nodes
+/// and static allocas at the start of the entry block. Output slots of calls
+/// are allocated there, while other blocks of the function are merged
+inline bool precedesMergedPart(const Instruction &I) {
+  if (isa<PHINode>(I))
+    return true;
+  auto *Alloca = dyn_cast<AllocaInst>(&I);
+  return Alloca && Alloca->isStaticAlloca();
+}
+
 /// \return begin iterator of the merged part of \p BB
 inline BasicBlock::iterator getBeginIt(BasicBlock *BB) {
   auto It = BB->begin();
-  while (isa<PHINode>(It))
+  while (precedesMergedPart(*It))
     ++It;
   return It;
 }
 
 inline BasicBlock::const_iterator getBeginIt(const BasicBlock *BB) {
   auto It = BB->begin();
-  while (isa<PHINode>(It))
+  while (precedesMergedPart(*It))
     ++It;
   return It;
 }
 
-/// Auxiliary class, that holds basic block and it's hash.
+/// Auxiliary class, that holds basic block, it's hash and encoding.
 /// Used BB for comparison
 class BBNode {
   mutable llvm::BasicBlock *BB;
   BBComparator::BasicBlockHash Hash;
+  BBEncodingTable::EncodingId Encoding;
 
 public:
   // Note the hash is recalculated potentially multiple times, but it is cheap.
-  BBNode(BasicBlock *BB) : BB(BB), Hash(BBComparator::basicBlockHash(*BB)) {}
+  BBNode(BasicBlock *BB, BBEncodingTable &Encodings)
+      : BB(BB), Hash(BBComparator::basicBlockHash(*BB)),
+        Encoding(Encodings.encode(*BB)) {}
 
   BasicBlock *getBB() const { return BB; }
 
   BBComparator::BasicBlockHash getHash() const { return Hash; }
+
+  BBEncodingTable::EncodingId getEncoding() const { return Encoding; }
 };
 
 /// Comparator for BBNode
@@ -88,15 +106,20 @@ class BBNodeCmp {
   } LastHasher;
 
   mutable BBComparator BBCmp;
+  const BBEncodingTable *Encodings;
 
 public:
-  BBNodeCmp(GlobalNumberState *GN) : BBCmp(GN) {}
+  BBNodeCmp(GlobalNumberState *GN, const BBEncodingTable *Encodings)
+      : BBCmp(GN), Encodings(Encodings) {}
 
   bool operator()(const BBNode &LHS, const BBNode &RHS) const {
-    // Order first by hashes, then full function comparison.
+    // Order first by hashes, then by encodings and then full function
+    // comparison. Equal blocks have equal encodings, so the order is the same.
 
     if (LHS.getHash() != RHS.getHash())
       return LHS.getHash() < RHS.getHash();
+    if (int Res = Encodings->compare(LHS.getEncoding(), RHS.getEncoding()))
+      return Res < 0;
     Optional<int> Hashed =
         LastHasher.getResult(reinterpret_cast<uintptr_t>(LHS.getBB()),
                              reinterpret_cast<uintptr_t>(RHS.getBB()));
@@ -222,12 +245,67 @@ template <typename T> bool SmartSortedSet<T>::contains(T InstId) const {
   return true;
 }
 
+////////// Per-group memory //////////
+
+/// Storage for the analysis state of one group of identical BBs.
+/// Arrays are allocated from the bump pointer allocator and temporary sets
+/// keep their buckets between uses, so the steady state of the pass doesn't
+/// go to the heap for every group. Everything, that was allocated, is
+/// released at once by reset() after the group is processed.
+/// Objects, allocated in the arena, must be trivially destructible.
+class GroupArena {
+public:
+  template <typename T> MutableArrayRef<T> allocate(size_t Size) {
+    if (Size == 0)
+      return MutableArrayRef<T>();
+    return MutableArrayRef<T>(Allocator.Allocate<T>(Size), Size);
+  }
+
+  template <typename T> MutableArrayRef<T> copy(ArrayRef<T> Values) {
+    MutableArrayRef<T> Result = allocate<T>(Values.size());
+    std::uninitialized_copy(Values.begin(), Values.end(), Result.begin());
+    return Result;
+  }
+
+  /// Temporary containers. Every getter returns an empty container;
+  /// the previous content is discarded, so they must not be used
+  /// by two callers simultaneously
+  DenseSet<const Value *> &getValueSet() { return clear(ValueSet); }
+  SmallVectorImpl<Value *> &getValueList() { return clear(ValueList); }
+  SmallPtrSetImpl<const Value *> &getBeforeSet() { return clear(BeforeSet); }
+  SmallPtrSetImpl<const Value *> &getAfterSet() { return clear(AfterSet); }
+  DenseMap<const Value *, Value *> &getInputMap() { return clear(InputMap); }
+  DenseMap<const Value *, Value *> &getOutputMap() { return clear(OutputMap); }
+
+  size_t getBytesAllocated() const { return Allocator.getBytesAllocated(); }
+
+  void reset() { Allocator.Reset(); }
+
+private:
+  template <typename T> static T &clear(T &Container) {
+    Container.clear();
+    return Container;
+  }
+
+  BumpPtrAllocator Allocator;
+  DenseSet<const Value *> ValueSet;
+  SmallVector<Value *, 16> ValueList;
+  SmallPtrSet<const Value *, 16> BeforeSet;
+  SmallPtrSet<const Value *, 16> AfterSet;
+  DenseMap<const Value *, Value *> InputMap;
+  DenseMap<const Value *, Value *> OutputMap;
+};
+
 BasicBlock *getMappedBBofIdenticalFunctions(const BasicBlock *BBToMap,
                                             Function *F);
 
 // TODO: probably we need one more argument ~ arch
 size_t getEHSize(const object::ObjectFile &F);
 
+// returns size of CIEs in .eh_frame of \p F. Every object file has its own
+// CIEs, while FDEs belong to functions
+size_t getCIESize(const object::ObjectFile &F);
+
 SmallVector<size_t, 8> getFunctionSizes(const object::ObjectFile &F,
                                         const SmallVectorImpl<StringRef> &Fs);
 
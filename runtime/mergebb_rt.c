@@ -0,0 +1,59 @@
+/*===-- mergebb_rt.c - Runtime of instrumented call sites ----------------===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+/*
+ * Modules, instrumented by -mergebb-instrument, register their tables of
+ * call sites by constructors. Counters of all tables are appended to the
+ * file from MERGEBB_PROFILE environment variable (mergebb.profile by
+ * default) at exit. The file is read by -mergebb-site-profile; counts of
+ * the same site are summed, so several runs accumulate.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct MergeBBSite {
+  const char *Caller;
+  const char *Block;
+  const char *Callee;
+};
+
+/* layout is created by CallSiteCounters::finalize */
+struct MergeBBTable {
+  uint64_t NumSites;
+  uint64_t *Counters;
+  const struct MergeBBSite *Sites;
+  struct MergeBBTable *Next;
+};
+
+static struct MergeBBTable *Tables;
+
+static void dumpTables(void) {
+  const char *FileName = getenv("MERGEBB_PROFILE");
+  FILE *File = fopen(FileName ? FileName : "mergebb.profile", "a");
+  if (!File) {
+    perror("mergebb: can't write profile");
+    return;
+  }
+  for (struct MergeBBTable *T = Tables; T; T = T->Next)
+    for (uint64_t i = 0; i < T->NumSites; ++i)
+      fprintf(File, "%llu\t%s\t%s\t%s\n",
+              (unsigned long long)__atomic_load_n(&T->Counters[i],
+                                                  __ATOMIC_RELAXED),
+              T->Sites[i].Caller, T->Sites[i].Block, T->Sites[i].Callee);
+  fclose(File);
+}
+
+/* constructors are run by a single thread */
+void __mergebb_register(struct MergeBBTable *Table) {
+  if (!Tables)
+    atexit(dumpTables);
+  Table->Next = Tables;
+  Tables = Table;
+}
@@ -0,0 +1,193 @@
+#!/usr/bin/python
+
+import argparse
+import os
+import os.path
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from utilities.functions import *
+from utilities.compile import *
+from utilities.constants import *
+
+## benchmark utils
+
+def run(query, isVerbose):
+    if isVerbose:
+        print("Query:", query)
+    err, out, error = createProcess(query)
+    if err != 0:
+        raise Exception("Query: " + query + "\nError: " + error)
+    return out, error
+
+
+def runWithMaxRss(query, isVerbose):
+    """ Runs query like run. Returns also its peak resident set size in KiB.
+        The child is waited by wait4, so its own usage is taken instead of the
+        maximum over all children of RUSAGE_CHILDREN """
+    if isVerbose:
+        print("Query:", query)
+    with tempfile.TemporaryFile() as out, tempfile.TemporaryFile() as err:
+        process = subprocess.Popen(query.split(), stdout=out, stderr=err)
+        _, status, usage = os.wait4(process.pid, 0)
+        process.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+        out.seek(0)
+        err.seek(0)
+        output, error = out.read().decode("utf-8"), err.read().decode("utf-8")
+    if process.returncode != 0:
+        raise Exception("Query: " + query + "\nError: " + error)
+    return output, error, usage.ru_maxrss
+
+
+def getCompiler(filename):
+    return g_clangpp + " -std=c++14" if getExt(filename) == ".cpp" else g_clang
+
+
+def buildProgram(filename, optLevel, isMerged, isVerbose):
+    """ Builds executable with or without the pass. Returns its filename and
+        peak memory of opt in KiB (None without the pass) """
+    shortName = getShortName(filename)
+    compiler = getCompiler(filename)
+    outDir = g_benchDir + "/" + shortName
+    if not os.path.exists(outDir):
+        os.makedirs(outDir)
+
+    irFile = outDir + "/" + shortName + ".ll"
+    run("{0} {1} -emit-llvm -S {2} -o {3}".format(compiler, optLevel, filename, irFile), isVerbose)
+    suffix = ""
+    maxRss = None
+    if isMerged:
+        suffix = "_bbf"
+        mergedFile = outDir + "/" + shortName + suffix + ".ll"
+        _, error, maxRss = runWithMaxRss("{0} {1} -S {2} {3}-o {4}".format(
+            g_opt, g_optCompileInfo.args, irFile, getArg(g_opt), mergedFile), isVerbose)
+        if isVerbose and error != "":
+            print("Opt:\n" + error)
+        irFile = mergedFile
+
+    exe = outDir + "/" + shortName + suffix
+    run("{0} {1} {2} {3} {4}-o {5}".format(compiler, optLevel, g_lldFlag, irFile,
+                                          getArg("link"), exe), isVerbose)
+    return exe, maxRss
+
+
+def getTextSize(exe):
+    out, _ = run("size " + exe, False)
+    return int(out.split()[6])
+
+
+def measure(exe, runs):
+    """ Returns output, median wall time and instructions (None, if perf
+        counters aren't available) """
+    times = []
+    output = None
+    instructions = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        process = subprocess.run([g_perfCount, exe], stdout=subprocess.PIPE,
+                                 stderr=subprocess.PIPE)
+        times.append(time.perf_counter() - start)
+        if process.returncode != 0:
+            raise Exception(exe + " failed with code " + str(process.returncode))
+        if output is not None and output != process.stdout:
+            raise Exception(exe + " has unstable output")
+        output = process.stdout
+        count = process.stderr.decode("utf-8").split("instructions: ")[-1].strip()
+        if count != "n/a":
+            instructions = int(count) if instructions is None else min(instructions, int(count))
+    return output, statistics.median(times), instructions
+
+
+def formatDelta(old, new):
+    if old is None or new is None:
+        return "n/a"
+    if old == 0:
+        return "{0} -> {1}".format(old, new)
+    return "{0} -> {1} ({2:+.2%})".format(old, new, (new - old) / old)
+
+
+def printTradeoff(name, sizes, times, instructions, maxRss):
+    print("File:", name)
+    sizeDelta = (sizes[0] - sizes[1]) / sizes[0]
+    sizeText = "text: {0} -> {1} ({2:+.2%})".format(sizes[0], sizes[1], -sizeDelta)
+    if sizes[1] < sizes[0]:
+        printSuccess(sizeText)
+    elif sizes[1] == sizes[0]:
+        print(sizeText)
+    else:
+        printFailure(sizeText)
+    print("time, ms: " + formatDelta(round(times[0] * 1000, 2), round(times[1] * 1000, 2)))
+    print("instructions: " + formatDelta(instructions[0], instructions[1]))
+    print("opt maxrss, KiB:", maxRss)
+    if sizes[0] != sizes[1] and times[0] > 0:
+        # relative change of time against relative change of size
+        slowdown = (times[1] - times[0]) / times[0]
+        print("tradeoff: {0:+.2%} time for {1:+.2%} text".format(slowdown, -sizeDelta))
+
+
+def benchmark(filename, optLevel, runs, isVerbose):
+    sizes, times, instructions, outputs = [], [], [], []
+    maxRss = None
+    for isMerged in [False, True]:
+        exe, optRss = buildProgram(filename, optLevel, isMerged, isVerbose)
+        if optRss is not None:
+            maxRss = optRss
+        sizes.append(getTextSize(exe))
+        output, wallTime, count = measure(exe, runs)
+        outputs.append(output)
+        times.append(wallTime)
+        instructions.append(count)
+    if outputs[0] != outputs[1]:
+        raise Exception("Outputs of original and merged programs differ")
+    printTradeoff(filename, sizes, times, instructions, maxRss)
+
+
+def buildPerfCount(isVerbose):
+    if not os.path.exists(g_benchDir):
+        os.makedirs(g_benchDir)
+    run("{0} -O2 {1} -o {2}".format(g_clang, g_benchPath + "/perfcount.c", g_perfCount), isVerbose)
+
+## end benchmark utils
+
+# start program
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+    description='Program builds benchmark programs (.c, .cpp) with and without bbfactor\
+    optimization by clang and lld, runs them several times and reports text size,\
+    wall time and instructions count (perf_event_open) of both versions')
+
+    programs = [os.path.join(g_benchPath, f) for f in sorted(os.listdir(g_benchPath))
+                if f != "perfcount.c"]
+    parser.add_argument('filenames', nargs='*', default=programs,
+                        help='Programs to be benchmarked. All from benchmarks directory by default')
+    parser.add_argument('--runs', type=int, default=5, help="Number of runs of every program")
+    parser.add_argument('-O', dest='optLevel', default="Oz", help="Optimization level of clang, Oz by default")
+    parser.add_argument('--args', nargs='*', default="", type=parseAdditionalArguments,
+                        help="Additional args in view like 'utility:extra flags' (opt, link)")
+    parser.add_argument('-v', action='store_true', help="Print queries and output of transforms")
+    parser.add_argument('--clean', action='store_true', help="Remove temporary directory")
+
+    args = parser.parse_args()
+
+    if args.clean:
+        if os.path.exists(g_benchDir):
+            shutil.rmtree(g_benchDir)
+        sys.exit()
+
+    try:
+        buildPerfCount(args.v)
+    except Exception as e:
+        printError(str(e))
+        sys.exit(1)
+
+    for filename in args.filenames:
+        if not os.path.exists(filename):
+            print("File ", filename, " does not exist")
+            continue
+        try:
+            benchmark(filename, "-" + args.optLevel, args.runs, args.v)
+        except Exception as e:
+            printError(str(e))
@@ -0,0 +1,92 @@
+// Container-heavy code: maps, vectors and strings of an inventory simulation
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Item {
+  std::string Name;
+  uint32_t Count = 0;
+  uint64_t Price = 0;
+};
+
+class Inventory {
+public:
+  void add(const std::string &Name, uint32_t Count, uint64_t Price) {
+    Item &I = Items[Name];
+    I.Name = Name;
+    I.Count += Count;
+    I.Price = Price;
+    History.push_back(Count);
+  }
+
+  bool remove(const std::string &Name, uint32_t Count) {
+    auto It = Items.find(Name);
+    if (It == Items.end() || It->second.Count < Count)
+      return false;
+    It->second.Count -= Count;
+    History.push_back(Count);
+    if (It->second.Count == 0)
+      Items.erase(It);
+    return true;
+  }
+
+  uint64_t value() const {
+    uint64_t Result = 0;
+    for (const auto &Entry : Items)
+      Result += Entry.second.Count * Entry.second.Price;
+    return Result;
+  }
+
+  std::vector<std::string> top(size_t N) const {
+    std::vector<const Item *> Sorted;
+    for (const auto &Entry : Items)
+      Sorted.push_back(&Entry.second);
+    std::sort(Sorted.begin(), Sorted.end(), [](const Item *L, const Item *R) {
+      return L->Count != R->Count ? L->Count > R->Count : L->Name < R->Name;
+    });
+    std::vector<std::string> Result;
+    for (size_t i = 0; i < N && i < Sorted.size(); ++i)
+      Result.push_back(Sorted[i]->Name);
+    return Result;
+  }
+
+  size_t historySize() const { return History.size(); }
+
+private:
+  std::map<std::string, Item> Items;
+  std::vector<uint32_t> History;
+};
+
+} // end anonymous namespace
+
+int main() {
+  Inventory Inv;
+  std::unordered_map<std::string, unsigned> Failures;
+  uint64_t Seed = 42;
+  auto Next = [&Seed]() {
+    Seed = Seed * 6364136223846793005ull + 1442695040888963407ull;
+    return static_cast<uint32_t>(Seed >> 33);
+  };
+
+  for (int i = 0; i < 400000; ++i) {
+    std::string Name = "item" + std::to_string(Next() % 2000);
+    if (Next() % 3)
+      Inv.add(Name, Next() % 10 + 1, Next() % 100);
+    else if (!Inv.remove(Name, Next() % 10 + 1))
+      ++Failures[Name];
+  }
+
+  uint64_t Hash = Inv.value() ^ Inv.historySize();
+  for (const std::string &Name : Inv.top(10))
+    for (char C : Name)
+      Hash = Hash * 31 + C;
+  std::printf("%llu %zu\n", static_cast<unsigned long long>(Hash),
+              Failures.size());
+  return 0;
+}
@@ -0,0 +1,74 @@
+// Exception handling: validation of records with throwing checks and
+// cleanups of local objects during unwinding
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct ValidationError : std::runtime_error {
+  explicit ValidationError(const std::string &Msg, int Code)
+      : std::runtime_error(Msg), Code(Code) {}
+  int Code;
+};
+
+struct Record {
+  int64_t Id;
+  int64_t Amount;
+  std::string Owner;
+};
+
+void checkId(const Record &R) {
+  if (R.Id % 97 == 0)
+    throw ValidationError("bad id " + std::to_string(R.Id), 1);
+}
+
+void checkAmount(const Record &R) {
+  if (R.Amount < 0)
+    throw ValidationError("negative amount of " + R.Owner, 2);
+  if (R.Amount > 900)
+    throw std::out_of_range("amount too large");
+}
+
+void checkOwner(const Record &R) {
+  if (R.Owner.size() > 7 && (R.Id & 15) == 0)
+    throw ValidationError("long owner " + R.Owner, 3);
+}
+
+int64_t process(const Record &R) {
+  auto Buffer = std::make_unique<std::vector<int64_t>>(4, R.Amount);
+  checkId(R);
+  checkAmount(R);
+  checkOwner(R);
+  int64_t Sum = 0;
+  for (int64_t V : *Buffer)
+    Sum += V;
+  return Sum;
+}
+
+} // end anonymous namespace
+
+int main() {
+  uint64_t Seed = 7;
+  int64_t Total = 0;
+  int Errors[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 300000; ++i) {
+    Seed = Seed * 6364136223846793005ull + 1442695040888963407ull;
+    Record R{static_cast<int64_t>(Seed >> 40),
+             static_cast<int64_t>((Seed >> 20) % 1000) - 50,
+             "user" + std::to_string((Seed >> 8) % 10000)};
+    try {
+      Total += process(R);
+    } catch (const ValidationError &E) {
+      ++Errors[E.Code];
+    } catch (const std::exception &) {
+      ++Errors[0];
+    }
+  }
+  std::printf("%lld %d %d %d %d\n", static_cast<long long>(Total), Errors[0],
+              Errors[1], Errors[2], Errors[3]);
+  return 0;
+}
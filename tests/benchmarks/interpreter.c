@@ -0,0 +1,117 @@
+// Stack machine interpreter: dispatch loop with many similar opcode handlers.
+// Arithmetic wraps, as it is done in unsigned type
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum Op { PUSH, LOAD, STORE, ADD, SUB, MUL, XOR, SHL, SHR, DUP, SWAP, JNZ, DEC,
+          HALT };
+
+typedef struct {
+  int64_t Stack[64];
+  int64_t Vars[8];
+  int Top;
+} Machine;
+
+static void push(Machine *M, int64_t V) {
+  if (M->Top == 64) {
+    fprintf(stderr, "stack overflow\n");
+    exit(1);
+  }
+  M->Stack[M->Top++] = V;
+}
+
+static int64_t pop(Machine *M) {
+  if (M->Top == 0) {
+    fprintf(stderr, "stack underflow\n");
+    exit(1);
+  }
+  return M->Stack[--M->Top];
+}
+
+static int64_t run(const int *Code, Machine *M) {
+  int Pc = 0;
+  for (;;) {
+    int64_t L, R;
+    switch (Code[Pc++]) {
+    case PUSH:
+      push(M, Code[Pc++]);
+      break;
+    case LOAD:
+      push(M, M->Vars[Code[Pc++]]);
+      break;
+    case STORE:
+      M->Vars[Code[Pc++]] = pop(M);
+      break;
+    case ADD:
+      R = pop(M);
+      L = pop(M);
+      push(M, (int64_t)((uint64_t)L + (uint64_t)R));
+      break;
+    case SUB:
+      R = pop(M);
+      L = pop(M);
+      push(M, (int64_t)((uint64_t)L - (uint64_t)R));
+      break;
+    case MUL:
+      R = pop(M);
+      L = pop(M);
+      push(M, (int64_t)((uint64_t)L * (uint64_t)R));
+      break;
+    case XOR:
+      R = pop(M);
+      L = pop(M);
+      push(M, L ^ R);
+      break;
+    case SHL:
+      R = pop(M);
+      L = pop(M);
+      push(M, (int64_t)((uint64_t)L << (R & 63)));
+      break;
+    case SHR:
+      R = pop(M);
+      L = pop(M);
+      push(M, (int64_t)((uint64_t)L >> (R & 63)));
+      break;
+    case DUP:
+      L = pop(M);
+      push(M, L);
+      push(M, L);
+      break;
+    case SWAP:
+      R = pop(M);
+      L = pop(M);
+      push(M, R);
+      push(M, L);
+      break;
+    case JNZ:
+      L = pop(M);
+      if (L)
+        Pc = Code[Pc];
+      else
+        ++Pc;
+      break;
+    case DEC:
+      M->Vars[Code[Pc++]] -= 1;
+      break;
+    case HALT:
+      return M->Vars[0];
+    default:
+      fprintf(stderr, "bad opcode\n");
+      exit(1);
+    }
+  }
+}
+
+int main(void) {
+  // hash = hash * 31 ^ (i << 3) + (i >> 1), for i = N..1
+  static const int Code[] = {
+      PUSH, 7,   STORE, 0,    PUSH, 3000000, STORE, 1,
+      /* 8 */ LOAD, 0, PUSH, 31, MUL, LOAD, 1, PUSH, 3, SHL, XOR,
+      LOAD, 1, PUSH, 1, SHR, ADD, STORE, 0,
+      DEC, 1, LOAD, 1, JNZ, 8, HALT};
+  Machine M = {{0}, {0}, 0};
+  int64_t Result = run(Code, &M);
+  printf("%lld %d\n", (long long)Result, M.Top);
+  return 0;
+}
@@ -0,0 +1,161 @@
+// Recursive descent parser of JSON-like documents, generated in memory
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  const char *Pos;
+  uint64_t Hash;
+  unsigned Depth;
+} Parser;
+
+static void fail(const char *Msg) {
+  fprintf(stderr, "parse error: %s\n", Msg);
+  exit(1);
+}
+
+static void mix(Parser *P, uint64_t V) { P->Hash = (P->Hash ^ V) * 1099511628211ull; }
+
+static void skipSpaces(Parser *P) {
+  while (*P->Pos == ' ' || *P->Pos == '\n')
+    ++P->Pos;
+}
+
+static void parseValue(Parser *P);
+
+static void parseString(Parser *P) {
+  if (*P->Pos != '"')
+    fail("expected string");
+  ++P->Pos;
+  while (*P->Pos != '"') {
+    if (!*P->Pos)
+      fail("unterminated string");
+    if (*P->Pos == '\\')
+      ++P->Pos;
+    mix(P, (unsigned char)*P->Pos++);
+  }
+  ++P->Pos;
+}
+
+static void parseNumber(Parser *P) {
+  int64_t V = 0;
+  int Negative = *P->Pos == '-';
+  if (Negative)
+    ++P->Pos;
+  if (*P->Pos < '0' || *P->Pos > '9')
+    fail("expected number");
+  while (*P->Pos >= '0' && *P->Pos <= '9')
+    V = V * 10 + (*P->Pos++ - '0');
+  mix(P, (uint64_t)(Negative ? -V : V));
+}
+
+static void parseArray(Parser *P) {
+  ++P->Pos;
+  skipSpaces(P);
+  if (*P->Pos == ']') {
+    ++P->Pos;
+    return;
+  }
+  for (;;) {
+    parseValue(P);
+    skipSpaces(P);
+    if (*P->Pos == ']') {
+      ++P->Pos;
+      return;
+    }
+    if (*P->Pos != ',')
+      fail("expected ',' in array");
+    ++P->Pos;
+  }
+}
+
+static void parseObject(Parser *P) {
+  ++P->Pos;
+  skipSpaces(P);
+  if (*P->Pos == '}') {
+    ++P->Pos;
+    return;
+  }
+  for (;;) {
+    skipSpaces(P);
+    parseString(P);
+    skipSpaces(P);
+    if (*P->Pos != ':')
+      fail("expected ':' in object");
+    ++P->Pos;
+    parseValue(P);
+    skipSpaces(P);
+    if (*P->Pos == '}') {
+      ++P->Pos;
+      return;
+    }
+    if (*P->Pos != ',')
+      fail("expected ',' in object");
+    ++P->Pos;
+  }
+}
+
+static void parseValue(Parser *P) {
+  skipSpaces(P);
+  if (++P->Depth > 64)
+    fail("too deep");
+  switch (*P->Pos) {
+  case '{':
+    parseObject(P);
+    break;
+  case '[':
+    parseArray(P);
+    break;
+  case '"':
+    parseString(P);
+    break;
+  case 't':
+    if (strncmp(P->Pos, "true", 4))
+      fail("expected true");
+    P->Pos += 4;
+    mix(P, 1);
+    break;
+  case 'f':
+    if (strncmp(P->Pos, "false", 5))
+      fail("expected false");
+    P->Pos += 5;
+    mix(P, 0);
+    break;
+  case 'n':
+    if (strncmp(P->Pos, "null", 4))
+      fail("expected null");
+    P->Pos += 4;
+    mix(P, 2);
+    break;
+  default:
+    parseNumber(P);
+  }
+  --P->Depth;
+}
+
+int main(void) {
+  enum { Records = 20000, Passes = 100 };
+  size_t Capacity = Records * 96 + 16, Size = 0;
+  char *Doc = malloc(Capacity);
+  if (!Doc)
+    return 1;
+  Size += sprintf(Doc + Size, "[");
+  for (int i = 0; i < Records; ++i)
+    Size += sprintf(Doc + Size,
+                    "%s{\"id\": %d, \"name\": \"item\\\"%d\", \"ok\": %s, "
+                    "\"tags\": [%d, -%d, null]}",
+                    i ? ",\n" : "", i, i * 7, i % 3 ? "true" : "false", i % 11,
+                    i % 5);
+  sprintf(Doc + Size, "]");
+
+  uint64_t Hash = 0;
+  for (int Pass = 0; Pass < Passes; ++Pass) {
+    Parser P = {Doc, 14695981039346656037ull + Pass, 0};
+    parseValue(&P);
+    Hash ^= P.Hash;
+  }
+  printf("%llu\n", (unsigned long long)Hash);
+  free(Doc);
+  return 0;
+}
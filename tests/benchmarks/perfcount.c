@@ -0,0 +1,64 @@
+// Runs a program and prints number of its retired user-space instructions
+// to stderr, counted by perf_event_open. Prints "n/a", if counters aren't
+// available (e.g. perf_event_paranoid or virtual machine without PMU)
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s program [args...]\n", argv[0]);
+    return 2;
+  }
+
+  struct perf_event_attr Attr;
+  memset(&Attr, 0, sizeof(Attr));
+  Attr.size = sizeof(Attr);
+  Attr.type = PERF_TYPE_HARDWARE;
+  Attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  Attr.disabled = 1;
+  Attr.enable_on_exec = 1;
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+  Attr.inherit = 1;
+
+  int Ready[2];
+  if (pipe(Ready))
+    return 2;
+  pid_t Child = fork();
+  if (Child < 0)
+    return 2;
+  if (Child == 0) {
+    // wait until the counter is attached
+    char C;
+    close(Ready[1]);
+    if (read(Ready[0], &C, 1) != 1)
+      _exit(127);
+    execvp(argv[1], argv + 1);
+    _exit(127);
+  }
+
+  close(Ready[0]);
+  int Fd = (int)syscall(SYS_perf_event_open, &Attr, Child, -1, -1, 0);
+  if (write(Ready[1], "x", 1) != 1)
+    return 2;
+  close(Ready[1]);
+
+  int Status;
+  if (waitpid(Child, &Status, 0) < 0)
+    return 2;
+
+  uint64_t Count;
+  if (Fd >= 0 && read(Fd, &Count, sizeof(Count)) == sizeof(Count))
+    fprintf(stderr, "instructions: %llu\n", (unsigned long long)Count);
+  else
+    fprintf(stderr, "instructions: n/a\n");
+  return WIFEXITED(Status) ? WEXITSTATUS(Status) : 1;
+}
@@ -0,0 +1,2 @@
+5000	bar	if.then	MergeBB_unnamed_0
+3	foo	if.then	MergeBB_unnamed_0
@@ -0,0 +1,101 @@
+; check, that the size of machine code, taken from the streamer, accounts
+; alignment of loops and relaxation of branches like the object file does
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -pass-remarks-analysis=mergebb -disable-output < %s 2> %t.obj
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-mc-size -pass-remarks-analysis=mergebb -disable-output < %s 2> %t.mc
+; RUN: cat %t.obj %t.mc | FileCheck %s
+
+; CHECK: old size [[OLD:[0-9]+]], new size [[NEW:[0-9]+]]
+; CHECK: old size [[OLD]], new size [[NEW]]
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+define void @foo(i32* %p, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %x = load volatile i32, i32* %p
+  %v = load volatile i32, i32* %p
+  %c1 = add nsw i32 %x, %v
+  %c2 = xor i32 %c1, %v
+  %c3 = sub nsw i32 %c2, %v
+  %c4 = mul nsw i32 %c3, %v
+  %c5 = add nsw i32 %c4, %v
+  %c6 = xor i32 %c5, %v
+  %c7 = sub nsw i32 %c6, %v
+  %c8 = mul nsw i32 %c7, %v
+  %c9 = add nsw i32 %c8, %v
+  %c10 = xor i32 %c9, %v
+  %c11 = sub nsw i32 %c10, %v
+  %c12 = mul nsw i32 %c11, %v
+  %c13 = add nsw i32 %c12, %v
+  %c14 = xor i32 %c13, %v
+  %c15 = sub nsw i32 %c14, %v
+  %c16 = mul nsw i32 %c15, %v
+  %c17 = add nsw i32 %c16, %v
+  %c18 = xor i32 %c17, %v
+  %c19 = sub nsw i32 %c18, %v
+  %c20 = mul nsw i32 %c19, %v
+  %c21 = add nsw i32 %c20, %v
+  %c22 = xor i32 %c21, %v
+  %c23 = sub nsw i32 %c22, %v
+  %c24 = mul nsw i32 %c23, %v
+  store volatile i32 %c24, i32* %p
+  %call = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %c24)
+  %next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %next, %n
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}
+
+define void @bar(i32* %p, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %x = load volatile i32, i32* %p
+  %v = load volatile i32, i32* %p
+  %c1 = add nsw i32 %x, %v
+  %c2 = xor i32 %c1, %v
+  %c3 = sub nsw i32 %c2, %v
+  %c4 = mul nsw i32 %c3, %v
+  %c5 = add nsw i32 %c4, %v
+  %c6 = xor i32 %c5, %v
+  %c7 = sub nsw i32 %c6, %v
+  %c8 = mul nsw i32 %c7, %v
+  %c9 = add nsw i32 %c8, %v
+  %c10 = xor i32 %c9, %v
+  %c11 = sub nsw i32 %c10, %v
+  %c12 = mul nsw i32 %c11, %v
+  %c13 = add nsw i32 %c12, %v
+  %c14 = xor i32 %c13, %v
+  %c15 = sub nsw i32 %c14, %v
+  %c16 = mul nsw i32 %c15, %v
+  %c17 = add nsw i32 %c16, %v
+  %c18 = xor i32 %c17, %v
+  %c19 = sub nsw i32 %c18, %v
+  %c20 = mul nsw i32 %c19, %v
+  %c21 = add nsw i32 %c20, %v
+  %c22 = xor i32 %c21, %v
+  %c23 = sub nsw i32 %c22, %v
+  %c24 = mul nsw i32 %c23, %v
+  store volatile i32 %c24, i32* %p
+  %call = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %c24)
+  %next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %next, %n
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}
+
+define i32 @main() {
+entry:
+  %a = alloca i32
+  store i32 1, i32* %a
+  call void @foo(i32* %a, i32 3)
+  call void @bar(i32* %a, i32 5)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
@@ -0,0 +1,88 @@
+; check, that the result doesn't depend on the run
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-rounds=3 < %s -o %t.1.bc
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-rounds=3 < %s -o %t.2.bc
+; RUN: cmp %t.1.bc %t.2.bc
+; RUN: llvm-as < %s > %t.in.bc
+; RUN: %mergebb %t.in.bc %force_flag -mergebb-rounds=3 -o %t.4.bc
+; RUN: %mergebb %t.in.bc %force_flag -mergebb-rounds=3 -o %t.5.bc
+; RUN: cmp %t.4.bc %t.5.bc
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+define i32 @f1(i32 %k) {
+entry:
+  %cmp = icmp sgt i32 %k, 10
+  br i1 %cmp, label %big, label %small
+big:
+  %a1 = mul nsw i32 %k, %k
+  %a2 = add nsw i32 %a1, %k
+  %a3 = mul nsw i32 %a2, %a1
+  %a4 = sub nsw i32 %a3, %a2
+  br label %end
+small:
+  %b1 = add nsw i32 %k, 31
+  %b2 = mul nsw i32 %b1, 5
+  %b3 = add nsw i32 %b1, %b2
+  %call = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %b3)
+  br label %end
+end:
+  %r = phi i32 [ %a4, %big ], [ %b3, %small ]
+  %r2 = phi i32 [ %a3, %big ], [ %b2, %small ]
+  %res = xor i32 %r, %r2
+  ret i32 %res
+}
+
+define i32 @f2(i32 %k) {
+entry:
+  %cmp = icmp slt i32 %k, 5
+  br i1 %cmp, label %small, label %big
+small:
+  %b1 = add nsw i32 %k, 31
+  %b2 = mul nsw i32 %b1, 5
+  %b3 = add nsw i32 %b1, %b2
+  %call = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %b3)
+  br label %big
+big:
+  %a1 = mul nsw i32 %k, %k
+  %a2 = add nsw i32 %a1, %k
+  %a3 = mul nsw i32 %a2, %a1
+  %a4 = sub nsw i32 %a3, %a2
+  %res = xor i32 %a4, %a3
+  ret i32 %res
+}
+
+define i32 @f3(i32 %k) {
+entry:
+  %b1 = add nsw i32 %k, 31
+  %b2 = mul nsw i32 %b1, 5
+  %b3 = add nsw i32 %b1, %b2
+  %call = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %b3)
+  br label %next
+next:
+  %a1 = mul nsw i32 %b3, %b3
+  %a2 = add nsw i32 %a1, %b3
+  %a3 = mul nsw i32 %a2, %a1
+  %a4 = sub nsw i32 %a3, %a2
+  br label %last
+last:
+  %c1 = mul nsw i32 %a4, %a4
+  %c2 = add nsw i32 %c1, %a4
+  %c3 = mul nsw i32 %c2, %c1
+  %c4 = sub nsw i32 %c3, %c2
+  %res = xor i32 %c4, %a3
+  ret i32 %res
+}
+
+define i32 @main() {
+entry:
+  %call1 = call i32 @f1(i32 3)
+  %call2 = call i32 @f2(i32 4)
+  %call3 = call i32 @f3(i32 5)
+  %sum1 = add i32 %call1, %call2
+  %sum2 = add i32 %sum1, %call3
+  %call4 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum2)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
@@ -1,14 +1,25 @@
 ; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s
 ; RUN: %lli_comp -v %s
+; the second round merges the blocks, rewritten by the first one
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-rounds=3 < %s | FileCheck %s --check-prefix=ROUNDS
 
 @.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
 
+; ROUNDS-LABEL: @foo
+; ROUNDS: call{{[a-z ]*}} i32 [[Wrapper:@[_\.A-Za-z0-9]+]](i32 %k)
+; ROUNDS-LABEL: @bar
+; ROUNDS: call{{[a-z ]*}} i32 [[Wrapper]](i32 %k)
+; ROUNDS: define private {{[a-z]*}} i32 [[Wrapper]](i32
+; ROUNDS: call{{[a-z ]*}} i32 @MergeBB_unnamed
+
 ; CHECK-LABEL: @foo
 define i32 @foo(i32 %k) {
 entry:
 ; CHECK: [[P0:%[_\.a-z0-9]+]] = alloca i32
+; CHECK: call void @llvm.lifetime.start{{[\.a-z0-9]*}}(i64 4,
 ; CHECK-NEXT: call{{[a-z ]*}} i32  [[FName:@[_\.A-Za-z0-9]+]](i32 %k, i32* [[P0]])
 ; CHECK-NEXT: load i32, i32* [[P0]]
+; CHECK: call void @llvm.lifetime.end{{[\.a-z0-9]*}}(i64 4,
   %someCalc1 = add nsw i32 %k, 31
   %someCalc2 = mul nsw i32 %someCalc1, 5
   %someCalc3 = add nsw i32 %someCalc1, %someCalc2
@@ -23,6 +34,7 @@ if.end:
 define i32 @bar(i32 %k) {
 entry:
 ; CHECK: [[P10:%[_\.a-z0-9]+]] = alloca i32
+; CHECK: call void @llvm.lifetime.start{{[\.a-z0-9]*}}(i64 4,
 ; CHECK-NEXT: call{{[a-z ]*}} i32 [[FName]](i32 %k, i32* [[P10]])
   %someCalc1 = add nsw i32 %k, 31
   %someCalc2 = mul nsw i32 %someCalc1, 5
@@ -0,0 +1,63 @@
+; check, that dry run reports decisions and doesn't modify the module
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-dry-run < %s | FileCheck %s
+; RUN: opt -load  %opt_path %pass_name -mergebb-dry-run -disable-output < %s 2>&1 | FileCheck %s --check-prefix=SUMMARY
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -pass-remarks=mergebb -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-mc-size -pass-remarks=mergebb -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-align-created -pass-remarks=mergebb -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-codegen-threads=2 -mergebb-codegen-split-min=2 -pass-remarks=mergebb -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-mc-size -mergebb-codegen-threads=2 -mergebb-codegen-split-min=2 -pass-remarks=mergebb -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; REMARK: group of 2 identical blocks with 1 inputs and 0 outputs; foo:if.then bar:if.then
+; REMARK: merged 2 blocks into new function (old size {{[0-9]+}}, new size {{[0-9]+}}, EH delta {{-?[0-9]+}}{{(, preferred alignment costs [0-9]+)?}})
+; REMARK: MergeBB dry run: 1 of 1 groups are profitable
+
+; profitability is decided by the cost model without forcing
+; SUMMARY: MergeBB dry run: 1 of 1 groups are profitable, estimated profit {{[1-9][0-9]*}} bytes
+
+; CHECK-NOT: MergeBB_unnamed
+; CHECK-LABEL: @foo
+define i32 @foo(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+; CHECK: %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 0
+if.else:
+  ret i32 %i
+}
+
+; CHECK-LABEL: @bar
+define i32 @bar(i32 %i) {
+entry:
+  %cmp = icmp sgt i32 %i, 1
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+; CHECK: %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 1
+if.else:
+  ret i32 %i
+}
+
+define i32 @main() {
+entry:
+  %call1 = call i32 @foo(i32 3)
+  %call2 = call i32 @bar(i32 5)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
@@ -0,0 +1,75 @@
+; check, that output slots, allocated in the entry block for calls from
+; other blocks, don't become a part of the entry block, merged by another group
+; of the same round, whichever group is merged first
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-share=false < %s | FileCheck %s
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; CHECK-LABEL: @foo
+; CHECK-NEXT: entry:
+; CHECK-NEXT: alloca i32
+; CHECK-NOT: mul nsw
+; CHECK-NOT: xor
+; CHECK-LABEL: @bar
+; CHECK-NEXT: entry:
+; CHECK-NEXT: alloca i32
+; CHECK-NOT: mul nsw
+; CHECK-NOT: xor
+; CHECK-LABEL: @main
+define i32 @foo(i32 %k, i32 %n) {
+entry:
+  %e1 = mul nsw i32 %k, %n
+  %e2 = add nsw i32 %e1, %k
+  %e3 = mul nsw i32 %e2, %e1
+  %e4 = sub nsw i32 %e3, %e2
+  %call0 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %e4)
+  br label %body
+
+body:
+  %b1 = xor i32 %k, %n
+  %b2 = shl i32 %b1, 3
+  %b3 = or i32 %b2, %k
+  %b4 = and i32 %b3, %n
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %b4)
+  br label %exit
+
+exit:
+  %r1 = add i32 %b2, %b3
+  %r2 = add i32 %r1, %b4
+  ret i32 %r2
+}
+
+define i32 @bar(i32 %k, i32 %n) {
+entry:
+  %e1 = mul nsw i32 %k, %n
+  %e2 = add nsw i32 %e1, %k
+  %e3 = mul nsw i32 %e2, %e1
+  %e4 = sub nsw i32 %e3, %e2
+  %call0 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %e4)
+  br label %body
+
+body:
+  %b1 = xor i32 %k, %n
+  %b2 = shl i32 %b1, 3
+  %b3 = or i32 %b2, %k
+  %b4 = and i32 %b3, %n
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %b4)
+  br label %exit
+
+exit:
+  %r1 = add i32 %b2, %b3
+  %r2 = add i32 %r1, %b4
+  ret i32 %r2
+}
+
+define i32 @main() {
+entry:
+  %call = call i32 @foo(i32 3, i32 10)
+  %call1 = call i32 @bar(i32 5, i32 7)
+  %sum = add i32 %call, %call1
+  %call2 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
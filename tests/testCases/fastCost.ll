@@ -0,0 +1,92 @@
+; check, that the fast estimate by target costs of instructions merges blocks
+; without compiling them
+; RUN: opt -S -load  %opt_path %pass_name -mergebb-fast-cost < %s | FileCheck %s
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+@arr = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8]
+
+; CHECK-LABEL: @foo
+; CHECK: call{{[a-z ]*}} void [[FName:@[_\.A-Za-z0-9]+]](i32* %f, i32 %n)
+define i32 @foo(i32* %f, i32 %n) {
+entry:
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %f
+  %y = mul nsw i32 %x, %n
+  %z = add nsw i32 %y, %x
+  %w = xor i32 %z, %y
+  %v = mul nsw i32 %w, %z
+  %u = sub nsw i32 %v, %w
+  %t = shl i32 %u, 2
+  %s = or i32 %t, %x
+  %r = add nsw i32 %s, %u
+  store i32 %r, i32* %f
+  br label %if.end
+if.end:
+  ret i32 %n
+}
+
+; CHECK-LABEL: @bar
+; CHECK: call{{[a-z ]*}} void [[FName]](i32* %b, i32 %n)
+define i32 @bar(i32* %b, i32 %n) {
+entry:
+  %cmp = icmp slt i32 %n, 5
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %b
+  %y = mul nsw i32 %x, %n
+  %z = add nsw i32 %y, %x
+  %w = xor i32 %z, %y
+  %v = mul nsw i32 %w, %z
+  %u = sub nsw i32 %v, %w
+  %t = shl i32 %u, 2
+  %s = or i32 %t, %x
+  %r = add nsw i32 %s, %u
+  store i32 %r, i32* %b
+  br label %if.end
+if.end:
+  ret i32 %n
+}
+
+; CHECK-LABEL: @baz
+; CHECK: call{{[a-z ]*}} void [[FName]](i32* %b, i32 %n)
+define i32 @baz(i32* %b, i32 %n) {
+entry:
+  %cmp = icmp sgt i32 %n, 2
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %b
+  %y = mul nsw i32 %x, %n
+  %z = add nsw i32 %y, %x
+  %w = xor i32 %z, %y
+  %v = mul nsw i32 %w, %z
+  %u = sub nsw i32 %v, %w
+  %t = shl i32 %u, 2
+  %s = or i32 %t, %x
+  %r = add nsw i32 %s, %u
+  store i32 %r, i32* %b
+  br label %if.end
+if.end:
+  ret i32 %n
+}
+
+define i32 @main() {
+entry:
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 0
+  %call = call i32 @foo(i32* %p, i32 3)
+  %p1 = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 2
+  %call1 = call i32 @bar(i32* %p1, i32 3)
+  %p2 = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 4
+  %call2 = call i32 @baz(i32* %p2, i32 3)
+  %x = load i32, i32* %p
+  %y = load i32, i32* %p1
+  %z = load i32, i32* %p2
+  %s1 = add i32 %x, %y
+  %sum = add i32 %s1, %z
+  %call3 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
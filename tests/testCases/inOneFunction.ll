@@ -1,11 +1,21 @@
 ; check, that it optimizes without errors
-; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-share=false < %s | FileCheck %s
+; identical blocks of the same function share a copy by default
+; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s --check-prefix=SHARE
+; the fast estimate calls a created function instead
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-fast-cost < %s | FileCheck %s
 ; Also test FunctionCompiler
 ; RUN: opt -S -load  %opt_path %pass_name < %s
 ; RUN: %lli_comp -v %s
 
 @.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
 
+; SHARE-LABEL: @foo
+; SHARE-NOT: call
+; SHARE: %dispatch = phi i32
+; SHARE: switch i32 %dispatch
+; SHARE-LABEL: @main
+
 ; CHECK-LABEL: @foo
 define i32 @foo(i32 %i) {
 entry:
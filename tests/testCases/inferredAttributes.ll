@@ -0,0 +1,59 @@
+; check, that memory and capture attributes of created functions are inferred
+; from their bodies
+; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+@arr = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8]
+
+; CHECK-LABEL: @foo
+; CHECK: call{{[a-z ]*}} i32 [[FName:@[_\.A-Za-z0-9]+]](i32* %a)
+define i32 @foo(i32* %a, i32 %n) {
+entry:
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %a
+  %g = getelementptr inbounds i32, i32* %a, i64 1
+  %y = load i32, i32* %g
+  %m = mul nsw i32 %x, %y
+  %s = add nsw i32 %m, %x
+  br label %if.end
+if.end:
+  %r = phi i32 [ %s, %if.then ], [ %n, %entry ]
+  ret i32 %r
+}
+
+; CHECK-LABEL: @bar
+; CHECK: call{{[a-z ]*}} i32 [[FName]](i32* %b)
+define i32 @bar(i32* %b, i32 %n) {
+entry:
+  %cmp = icmp slt i32 %n, 5
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %b
+  %g = getelementptr inbounds i32, i32* %b, i64 1
+  %y = load i32, i32* %g
+  %m = mul nsw i32 %x, %y
+  %s = add nsw i32 %m, %x
+  br label %if.end
+if.end:
+  %r = phi i32 [ %s, %if.then ], [ 1, %entry ]
+  ret i32 %r
+}
+
+; CHECK: define private {{[a-z]*}} i32 [[FName]](i32* nocapture nonnull{{[^,]*}}) [[Attrs:#[0-9]+]]
+; CHECK: attributes [[Attrs]] = { {{.*}}argmemonly{{.*}} readonly{{.*}} }
+
+define i32 @main() {
+entry:
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 0
+  %call = call i32 @foo(i32* %p, i32 3)
+  %p1 = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 4
+  %call1 = call i32 @bar(i32* %p1, i32 3)
+  %sum = add i32 %call, %call1
+  %call2 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
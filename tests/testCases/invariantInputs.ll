@@ -0,0 +1,68 @@
+; check, that inputs, computed in the same way at every call site from other
+; inputs, aren't passed, but are computed by the created function
+; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name < %s | FileCheck %s --check-prefix=COST
+; RUN: opt -load  %opt_path %pass_name -mergebb-dry-run -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s --check-prefix=DRY
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+@arr = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8]
+
+; cost model measures calls without sunk inputs
+; COST-LABEL: @foo
+; COST-LABEL: @bar
+; COST-LABEL: @main
+; DRY: group of 2 identical blocks with 1 inputs
+; DRY: MergeBB dry run: {{[01]}} of 1 groups are profitable
+
+; CHECK-LABEL: @foo
+; CHECK: call{{[a-z ]*}} i32 [[FName:@[_\.A-Za-z0-9]+]](i32* %a)
+define i32 @foo(i32* %a, i32 %n) {
+entry:
+  %q = getelementptr inbounds i32, i32* %a, i64 2
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %x = load i32, i32* %a
+  %y = load i32, i32* %q
+  %m = mul nsw i32 %x, %y
+  %s = add nsw i32 %m, %y
+  store i32 %s, i32* %q
+  ret i32 %s
+if.else:
+  ret i32 %n
+}
+
+; CHECK-LABEL: @bar
+; CHECK: call{{[a-z ]*}} i32 [[FName]](i32* %b)
+define i32 @bar(i32* %b, i32 %n) {
+entry:
+  %r = getelementptr inbounds i32, i32* %b, i64 2
+  %cmp = icmp slt i32 %n, 5
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %x = load i32, i32* %b
+  %y = load i32, i32* %r
+  %m = mul nsw i32 %x, %y
+  %s = add nsw i32 %m, %y
+  store i32 %s, i32* %r
+  ret i32 %s
+if.else:
+  ret i32 %n
+}
+
+; CHECK: define private {{[a-z]*}} i32 [[FName]](i32*{{[^,]*}})
+; CHECK: getelementptr inbounds i32, i32* %0, i64 2
+
+define i32 @main() {
+entry:
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 0
+  %call = call i32 @foo(i32* %p, i32 3)
+  %p1 = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 4
+  %call1 = call i32 @bar(i32* %p1, i32 3)
+  %sum = add i32 %call, %call1
+  %call2 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
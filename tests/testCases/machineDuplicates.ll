@@ -0,0 +1,44 @@
+; check, that blocks, which differ only by flags of instructions, are reported
+; as identical machine code, missed by merging
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-report-machine-duplicates -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s
+; the fast estimate doesn't compile, but the report does
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-fast-cost -mergebb-report-machine-duplicates -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s
+
+; CHECK: 2 blocks with identical machine code of {{[0-9]+}} bytes, merging misses {{[0-9]+}} bytes; foo:if.then bar:if.then
+; CHECK: MergeBB machine duplicates: {{[1-9][0-9]*}} groups, {{[1-9][0-9]*}} missed bytes; {{[0-9]+}} diverged groups of identical blocks
+
+define void @foo(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %c1 = mul nsw i32 %i, %i
+  %c2 = add nsw i32 %c1, %i
+  %c3 = xor i32 %c2, %c1
+  %c4 = add nsw i32 %c3, %c2
+  %c5 = mul nsw i32 %c4, %c3
+  %c6 = sub nsw i32 %c5, %c4
+  call void @use(i32 %c6)
+  br label %if.end
+if.end:
+  ret void
+}
+
+define void @bar(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %c1 = mul i32 %i, %i
+  %c2 = add i32 %c1, %i
+  %c3 = xor i32 %c2, %c1
+  %c4 = add i32 %c3, %c2
+  %c5 = mul i32 %c4, %c3
+  %c6 = sub i32 %c5, %c4
+  call void @use(i32 %c6)
+  br label %if.end
+if.end:
+  ret void
+}
+
+declare void @use(i32)
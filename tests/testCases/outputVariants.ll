@@ -0,0 +1,115 @@
+; check, that members of a group with different outputs are merged into
+; separate functions, and blocks without used outputs don't pass slots for them
+; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-split-outputs=false < %s | FileCheck %s --check-prefix=UNION
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+@arr = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8]
+
+; CHECK-LABEL: @foo
+; CHECK: call{{[a-z ]*}} i32 [[Out:@[_\.A-Za-z0-9]+]](i32* %a, i32 %n, i32*
+; UNION-LABEL: @foo
+; UNION: call{{[a-z ]*}} i32 [[Union:@[_\.A-Za-z0-9]+]](i32* %a, i32 %n, i32*
+define i32 @foo(i32* %a, i32 %n) {
+entry:
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %a
+  %y = mul nsw i32 %x, %n
+  %z = add nsw i32 %y, %x
+  %w = xor i32 %z, %y
+  store i32 %w, i32* %a
+  br label %if.end
+if.end:
+  %r = phi i32 [ %y, %if.then ], [ %n, %entry ]
+  %s = phi i32 [ %w, %if.then ], [ 0, %entry ]
+  %t = add i32 %r, %s
+  ret i32 %t
+}
+
+; CHECK-LABEL: @bar
+; CHECK: call{{[a-z ]*}} i32 [[Out]](i32* %b, i32 %n, i32*
+; UNION-LABEL: @bar
+; UNION: call{{[a-z ]*}} i32 [[Union]](i32* %b, i32 %n, i32*
+define i32 @bar(i32* %b, i32 %n) {
+entry:
+  %cmp = icmp slt i32 %n, 5
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %b
+  %y = mul nsw i32 %x, %n
+  %z = add nsw i32 %y, %x
+  %w = xor i32 %z, %y
+  store i32 %w, i32* %b
+  br label %if.end
+if.end:
+  %r = phi i32 [ %y, %if.then ], [ %n, %entry ]
+  %s = phi i32 [ %w, %if.then ], [ 1, %entry ]
+  %t = sub i32 %r, %s
+  ret i32 %t
+}
+
+; CHECK-LABEL: @baz
+; CHECK-NOT: call{{.*}} [[Out]](
+; CHECK: call{{[a-z ]*}} {{[a-z0-9]+}} [[NoOut:@[_\.A-Za-z0-9]+]](i32* %c, i32 %n)
+; UNION-LABEL: @baz
+; UNION: call{{[a-z ]*}} i32 [[Union]](i32* %c, i32 %n, i32*
+define i32 @baz(i32* %c, i32 %n) {
+entry:
+  %cmp = icmp sgt i32 %n, 2
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %c
+  %y = mul nsw i32 %x, %n
+  %z = add nsw i32 %y, %x
+  %w = xor i32 %z, %y
+  store i32 %w, i32* %c
+  br label %if.end
+if.end:
+  ret i32 %n
+}
+
+; CHECK-LABEL: @qux
+; CHECK: call{{[a-z ]*}} {{[a-z0-9]+}} [[NoOut]](i32* %d, i32 %n)
+; UNION-LABEL: @qux
+; UNION: call{{[a-z ]*}} i32 [[Union]](i32* %d, i32 %n, i32*
+define i32 @qux(i32* %d, i32 %n) {
+entry:
+  %cmp = icmp slt i32 %n, 7
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %x = load i32, i32* %d
+  %y = mul nsw i32 %x, %n
+  %z = add nsw i32 %y, %x
+  %w = xor i32 %z, %y
+  store i32 %w, i32* %d
+  br label %if.end
+if.end:
+  %m = mul i32 %n, 3
+  ret i32 %m
+}
+
+define i32 @main() {
+entry:
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 0
+  %call = call i32 @foo(i32* %p, i32 3)
+  %p1 = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 2
+  %call1 = call i32 @bar(i32* %p1, i32 3)
+  %p2 = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 4
+  %call2 = call i32 @baz(i32* %p2, i32 3)
+  %p3 = getelementptr inbounds [8 x i32], [8 x i32]* @arr, i64 0, i64 6
+  %call3 = call i32 @qux(i32* %p3, i32 3)
+  %x = load i32, i32* %p2
+  %y = load i32, i32* %p3
+  %s1 = add i32 %call, %call1
+  %s2 = add i32 %call2, %call3
+  %s3 = add i32 %s1, %s2
+  %s4 = add i32 %x, %y
+  %sum = add i32 %s3, %s4
+  %call4 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
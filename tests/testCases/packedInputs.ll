@@ -0,0 +1,57 @@
+; check, that inputs over the registers limit are passed in a struct by
+; pointer, which is allocated in the entry block
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-register-args=3 < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-register-args=0 < %s | FileCheck %s --check-prefix=FLAT
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; CHECK-LABEL: @foo
+; CHECK: [[Pack:%[_\.a-z0-9]+]] = alloca { i32, i32, i32 }
+; CHECK: store i32 %c
+; CHECK: store i32 %d
+; CHECK: store i32 %e
+; CHECK: call{{[a-z ]*}} i32 [[FName:@[_\.A-Za-z0-9]+]](i32 %a, i32 %b, { i32, i32, i32 }* [[Pack]])
+; FLAT-LABEL: @foo
+; FLAT: call{{[a-z ]*}} i32 {{@[_\.A-Za-z0-9]+}}(i32 %a, i32 %b, i32 %c, i32 %d, i32 %e)
+define i32 @foo(i32 %a, i32 %b, i32 %c, i32 %d, i32 %e, i1 %cond) {
+entry:
+  br i1 %cond, label %if.then, label %if.else
+if.then:
+  %m1 = mul nsw i32 %a, %b
+  %m2 = mul nsw i32 %m1, %c
+  %m3 = add nsw i32 %m2, %d
+  %m4 = sub nsw i32 %m3, %e
+  %m5 = mul nsw i32 %m4, %m1
+  ret i32 %m5
+if.else:
+  ret i32 %a
+}
+
+define i32 @bar(i32 %a, i32 %b, i32 %c, i32 %d, i32 %e, i1 %cond) {
+entry:
+  br i1 %cond, label %if.then, label %if.else
+if.then:
+  %m1 = mul nsw i32 %a, %b
+  %m2 = mul nsw i32 %m1, %c
+  %m3 = add nsw i32 %m2, %d
+  %m4 = sub nsw i32 %m3, %e
+  %m5 = mul nsw i32 %m4, %m1
+  ret i32 %m5
+if.else:
+  ret i32 %b
+}
+
+; CHECK: define private {{[a-z]*}} i32 [[FName]](i32{{[^,]*}}, i32{{[^,]*}}, { i32, i32, i32 }* {{.*}}readonly
+; CHECK: getelementptr inbounds { i32, i32, i32 }, { i32, i32, i32 }* %2, i32 0, i32 2
+
+define i32 @main() {
+entry:
+  %call = call i32 @foo(i32 1, i32 2, i32 3, i32 4, i32 5, i1 true)
+  %call1 = call i32 @bar(i32 5, i32 4, i32 3, i32 2, i32 1, i1 true)
+  %sum = add i32 %call, %call1
+  %call2 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
@@ -0,0 +1,96 @@
+; check, that functions, created for cold blocks only, are placed into cold
+; section, and hot ones are ordered after their callers
+; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-cold-section=.text.outlined < %s | FileCheck %s --check-prefix=SECTION
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-symbol-order=%t.order -disable-output < %s
+; RUN: FileCheck %s --check-prefix=ORDER < %t.order
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; CHECK: !section_prefix ![[PREFIX:[0-9]+]]
+; CHECK-NOT: !section_prefix
+; CHECK: ![[PREFIX]] = !{!"function_section_prefix", !".unlikely"}
+
+; SECTION: section ".text.outlined"
+; SECTION-NOT: section ".text.outlined"
+
+; ORDER: {{^(foo|bar)$}}
+; ORDER-NEXT: {{^MergeBB_unnamed_[0-9]+$}}
+; ORDER-NOT: cold
+
+define i32 @foo(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 0
+if.else:
+  ret i32 %i
+}
+
+define i32 @bar(i32 %i) {
+entry:
+  %cmp = icmp sgt i32 %i, 1
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 1
+if.else:
+  ret i32 %i
+}
+
+define i32 @coldFoo(i32 %i) #0 {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = xor i32 %i, 7
+  %someCalc2 = add nsw i32 %i, %someCalc1
+  %someCalc3 = mul nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc2
+  %someCalc5 = xor i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 0
+if.else:
+  ret i32 %i
+}
+
+define i32 @coldBar(i32 %i) #0 {
+entry:
+  %cmp = icmp sgt i32 %i, 1
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = xor i32 %i, 7
+  %someCalc2 = add nsw i32 %i, %someCalc1
+  %someCalc3 = mul nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc2
+  %someCalc5 = xor i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 1
+if.else:
+  ret i32 %i
+}
+
+define i32 @main() {
+entry:
+  %call1 = call i32 @foo(i32 3)
+  %call2 = call i32 @bar(i32 5)
+  %call3 = call i32 @coldFoo(i32 3)
+  %call4 = call i32 @coldBar(i32 5)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
+
+attributes #0 = { cold }
@@ -0,0 +1,49 @@
+; check, that the end of the merging round is reported with progress
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-progress=60 -mergebb-deadline=600 -mergebb-cancel-on-signal -disable-output < %s 2>&1 | FileCheck %s
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; CHECK: MergeBB progress: round 1, 1 of 1 groups, saved {{-?[0-9]+}} bytes
+; CHECK-NOT: cancelled
+
+define i32 @foo(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 0
+if.else:
+  ret i32 %i
+}
+
+define i32 @bar(i32 %i) {
+entry:
+  %cmp = icmp sgt i32 %i, 1
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 1
+if.else:
+  ret i32 %i
+}
+
+define i32 @main() {
+entry:
+  %call1 = call i32 @foo(i32 3)
+  %call2 = call i32 @bar(i32 5)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
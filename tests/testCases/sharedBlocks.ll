@@ -0,0 +1,67 @@
+; check, that identical blocks of the same function share a single copy,
+; which returns to the right continuation by switch
+; RUN: opt -S -load  %opt_path %pass_name %force_flag < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name < %s
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; CHECK-LABEL: @foo
+define i32 @foo(i32 %k, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %latch ]
+  %sum = phi i32 [ 0, %entry ], [ %sum.next, %latch ]
+  %odd = and i32 %i, 1
+  %isOdd = icmp ne i32 %odd, 0
+  br i1 %isOdd, label %first, label %second
+
+; CHECK: first:
+; CHECK-NEXT: br label %[[Shared:[_\.a-z0-9]+]]
+first:
+  %a1 = mul nsw i32 %i, %k
+  %a2 = add nsw i32 %a1, %k
+  %a3 = mul nsw i32 %a2, %a1
+  %a4 = sub nsw i32 %a3, %a2
+  br label %latch
+
+; CHECK: [[Shared]]:
+; CHECK-NEXT: %dispatch = phi i32 [ 0, %first ], [ 1, %second ]
+; CHECK: switch i32 %dispatch
+; CHECK: second:
+; CHECK-NEXT: br label %[[Shared]]
+second:
+  %b1 = mul nsw i32 %i, %k
+  %b2 = add nsw i32 %b1, %k
+  %b3 = mul nsw i32 %b2, %b1
+  %b4 = sub nsw i32 %b3, %b2
+  br label %latch
+
+; CHECK: latch:
+; CHECK-NOT: call
+latch:
+  %v = phi i32 [ %a3, %first ], [ %b3, %second ]
+  %w = phi i32 [ %a4, %first ], [ %b4, %second ]
+  %vw = xor i32 %v, %w
+  %sum.next = add i32 %sum, %vw
+  %inc = add nuw nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit
+
+; CHECK-LABEL: exit:
+exit:
+  ret i32 %sum.next
+}
+
+; CHECK-LABEL: @main
+; CHECK-NOT: define
+define i32 @main() {
+entry:
+  %call = call i32 @foo(i32 3, i32 10)
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %call)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
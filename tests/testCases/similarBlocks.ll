@@ -0,0 +1,69 @@
+; check, that blocks, which differ by one instruction, are reported as similar
+; RUN: opt -load  %opt_path %pass_name %force_flag -mergebb-dry-run -mergebb-report-similar -pass-remarks-analysis=mergebb -disable-output < %s 2>&1 | FileCheck %s
+
+; CHECK: cluster of 2 similar blocks with estimated similarity {{[0-9]+}}%; foo:if.then bar:if.then
+; CHECK: MergeBB similar blocks: 1 clusters of 2 candidate blocks
+
+define void @foo(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %c1 = mul nsw i32 %i, %i
+  %c2 = add nsw i32 %c1, %i
+  %c3 = xor i32 %c2, %c1
+  %c4 = add nsw i32 %c3, %c2
+  %c5 = mul nsw i32 %c4, %c3
+  %c6 = sub nsw i32 %c5, %c4
+  %c7 = xor i32 %c6, %c5
+  %c8 = add nsw i32 %c7, %c6
+  %c9 = mul nsw i32 %c8, %c7
+  %c10 = sub nsw i32 %c9, %c8
+  %c11 = xor i32 %c10, %c9
+  %c12 = add nsw i32 %c11, %c10
+  %c13 = mul nsw i32 %c12, %c11
+  %c14 = sub nsw i32 %c13, %c12
+  %c15 = xor i32 %c14, %c13
+  %c16 = add nsw i32 %c15, %c14
+  %c17 = mul nsw i32 %c16, %c15
+  %c18 = sub nsw i32 %c17, %c16
+  %c19 = xor i32 %c18, %c17
+  %c20 = and i32 %c19, %c18
+  call void @use(i32 %c20)
+  br label %if.end
+if.end:
+  ret void
+}
+
+define void @bar(i32 %i) {
+entry:
+  %cmp = icmp sgt i32 %i, 1
+  br i1 %cmp, label %if.then, label %if.end
+if.then:
+  %c1 = mul nsw i32 %i, %i
+  %c2 = add nsw i32 %c1, %i
+  %c3 = xor i32 %c2, %c1
+  %c4 = add nsw i32 %c3, %c2
+  %c5 = mul nsw i32 %c4, %c3
+  %c6 = sub nsw i32 %c5, %c4
+  %c7 = xor i32 %c6, %c5
+  %c8 = add nsw i32 %c7, %c6
+  %c9 = mul nsw i32 %c8, %c7
+  %c10 = sub nsw i32 %c9, %c8
+  %c11 = xor i32 %c10, %c9
+  %c12 = add nsw i32 %c11, %c10
+  %c13 = mul nsw i32 %c12, %c11
+  %c14 = sub nsw i32 %c13, %c12
+  %c15 = xor i32 %c14, %c13
+  %c16 = add nsw i32 %c15, %c14
+  %c17 = mul nsw i32 %c16, %c15
+  %c18 = sub nsw i32 %c17, %c16
+  %c19 = xor i32 %c18, %c17
+  %c20 = or i32 %c19, %c18
+  call void @use(i32 %c20)
+  br label %if.end
+if.end:
+  ret void
+}
+
+declare void @use(i32)
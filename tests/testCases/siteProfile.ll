@@ -0,0 +1,83 @@
+; check, that calls of created functions are counted by instrumentation, and
+; that blocks with hot call sites aren't merged due to the dumped counters
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-instrument < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name %force_flag -mergebb-site-profile=%S/Inputs/hotSites.profile < %s | FileCheck %s --check-prefix=PROFILE
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; CHECK: @llvm.global_ctors = {{.*}} @mergebb.register
+; CHECK-LABEL: @foo
+; CHECK: atomicrmw add i64* getelementptr inbounds ([3 x i64], [3 x i64]* @mergebb.counters, i64 0, i64 0), i64 1 monotonic
+; CHECK-NEXT: call
+; CHECK-LABEL: @bar
+; CHECK: atomicrmw add i64* getelementptr inbounds ([3 x i64], [3 x i64]* @mergebb.counters, i64 0, i64 1), i64 1 monotonic
+; CHECK-LABEL: @baz
+; CHECK: atomicrmw add i64* getelementptr inbounds ([3 x i64], [3 x i64]* @mergebb.counters, i64 0, i64 2), i64 1 monotonic
+; CHECK: define internal void @mergebb.register()
+; CHECK-NEXT: call void @__mergebb_register(i8* bitcast
+
+; PROFILE-LABEL: @foo
+; PROFILE: call{{[a-z ]*}} void @MergeBB
+; PROFILE-LABEL: @bar
+; PROFILE-NOT: call{{[a-z ]*}} void @MergeBB
+; PROFILE-LABEL: @baz
+; PROFILE: call{{[a-z ]*}} void @MergeBB
+
+define i32 @foo(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 0
+if.else:
+  ret i32 %i
+}
+
+define i32 @bar(i32 %i) {
+entry:
+  %cmp = icmp sgt i32 %i, 1
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 1
+if.else:
+  ret i32 %i
+}
+
+define i32 @baz(i32 %i) {
+entry:
+  %cmp = icmp slt i32 %i, 5
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 2
+if.else:
+  ret i32 %i
+}
+
+define i32 @main() {
+entry:
+  %call = call i32 @foo(i32 3)
+  %call1 = call i32 @bar(i32 4)
+  %call2 = call i32 @baz(i32 2)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
@@ -0,0 +1,67 @@
+; check, that standalone tool loads candidates lazily and keeps other functions
+; RUN: llvm-as < %s > %t.bc
+; RUN: %mergebb %t.bc %force_flag -S -o - | FileCheck %s
+; RUN: %mergebb %t.bc %force_flag -no-lazy -S -o - | FileCheck %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+
+; CHECK-LABEL: @foo
+define i32 @foo(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 0
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+; CHECK: call{{[a-z ]*}} void [[FName:@[_\.A-Za-z0-9]+]](i32 %i)
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 0
+if.else:
+  ret i32 %i
+}
+
+; CHECK-LABEL: @bar
+define i32 @bar(i32 %i) {
+entry:
+  %cmp = icmp sge i32 %i, 1
+  br i1 %cmp, label %if.then, label %if.else
+if.then:
+; CHECK: call{{[a-z ]*}} void [[FName]](i32 %i)
+  %someCalc1 = mul nsw i32 %i, %i
+  %someCalc2 = mul nsw i32 %i, %someCalc1
+  %someCalc3 = add nsw i32 %someCalc2, %someCalc1
+  %someCalc4 = sub nsw i32 %someCalc3, %someCalc1
+  %someCalc5 = mul nsw i32 %someCalc3, %someCalc4
+  %call1 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %someCalc5)
+  ret i32 1
+if.else:
+  ret i32 %i
+}
+
+; not a candidate: the body must survive lazy loading
+; CHECK-LABEL: @baz
+define i32 @baz(i32 %i) {
+entry:
+; CHECK: %x = sdiv i32 %i, 3
+; CHECK-NEXT: %y = xor i32 %x, %i
+; CHECK-NEXT: %z = shl i32 %y, 2
+; CHECK-NEXT: %w = or i32 %z, %x
+  %x = sdiv i32 %i, 3
+  %y = xor i32 %x, %i
+  %z = shl i32 %y, 2
+  %w = or i32 %z, %x
+  ret i32 %w
+}
+
+define i32 @main() {
+entry:
+  %call1 = call i32 @foo(i32 3)
+  %call2 = call i32 @bar(i32 5)
+  %call3 = call i32 @baz(i32 7)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
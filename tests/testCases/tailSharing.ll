@@ -0,0 +1,127 @@
+; check, that functions, ending in the same instructions, tail call a single
+; copy of their common tail: a function, which is the whole tail, or a created
+; one, taking values, that the tail doesn't define
+; RUN: opt -S -load  %opt_path %pass_name < %s | FileCheck %s
+; RUN: opt -S -load  %opt_path %pass_name -mergebb-share-tails=false < %s | FileCheck %s --check-prefix=NOTAIL
+; standalone tool loads single-block functions for tail sharing
+; RUN: llvm-as < %s > %t.bc
+; RUN: %mergebb %t.bc -S -o - | FileCheck %s
+; RUN: %lli_comp -v %s
+
+@.str = private unnamed_addr constant [4 x i8] c"%d\0A\00", align 1
+@.str.1 = private unnamed_addr constant [5 x i8] c"%ld\0A\00", align 1
+
+; CHECK-LABEL: @f1
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %p = mul nsw i32 %a, 7
+; CHECK-NEXT: [[R1:%[0-9]+]] = tail call i32 @f3(i32 %p, i32 %b)
+; CHECK-NEXT: ret i32 [[R1]]
+; NOTAIL-LABEL: @f1
+; NOTAIL-NOT: call
+; NOTAIL: ret i32
+define i32 @f1(i32 %a, i32 %b) {
+entry:
+  %p = mul nsw i32 %a, 7
+  %t1 = mul nsw i32 %p, %b
+  %t2 = add nsw i32 %t1, %p
+  %t3 = xor i32 %t2, %b
+  %t4 = mul nsw i32 %t3, %t2
+  %t5 = sub nsw i32 %t4, %t1
+  %t6 = shl i32 %t5, 3
+  %t7 = or i32 %t6, %t3
+  %t8 = mul nsw i32 %t7, %t5
+  ret i32 %t8
+}
+
+; CHECK-LABEL: @f2
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %p = sdiv i32 %a, 3
+; CHECK-NEXT: [[R2:%[0-9]+]] = tail call i32 @f3(i32 %p, i32 %b)
+; CHECK-NEXT: ret i32 [[R2]]
+define i32 @f2(i32 %a, i32 %b) {
+entry:
+  %p = sdiv i32 %a, 3
+  %t1 = mul nsw i32 %p, %b
+  %t2 = add nsw i32 %t1, %p
+  %t3 = xor i32 %t2, %b
+  %t4 = mul nsw i32 %t3, %t2
+  %t5 = sub nsw i32 %t4, %t1
+  %t6 = shl i32 %t5, 3
+  %t7 = or i32 %t6, %t3
+  %t8 = mul nsw i32 %t7, %t5
+  ret i32 %t8
+}
+
+; CHECK-LABEL: @f3
+; CHECK-NOT: call
+; CHECK: ret i32 %t8
+define i32 @f3(i32 %x, i32 %y) {
+entry:
+  %t1 = mul nsw i32 %x, %y
+  %t2 = add nsw i32 %t1, %x
+  %t3 = xor i32 %t2, %y
+  %t4 = mul nsw i32 %t3, %t2
+  %t5 = sub nsw i32 %t4, %t1
+  %t6 = shl i32 %t5, 3
+  %t7 = or i32 %t6, %t3
+  %t8 = mul nsw i32 %t7, %t5
+  ret i32 %t8
+}
+
+; CHECK-LABEL: @g1
+; CHECK: %q = add nsw i64 %p, %b
+; CHECK-NEXT: [[R3:%[0-9]+]] = tail call i64 [[Tail:@[_\.A-Za-z0-9]+]](i64 %q, i64 %b)
+; CHECK-NEXT: ret i64 [[R3]]
+define i64 @g1(i64 %a, i64 %b) {
+entry:
+  %p = mul nsw i64 %a, 11
+  %q = add nsw i64 %p, %b
+  %t1 = mul nsw i64 %q, %b
+  %t2 = add nsw i64 %t1, %q
+  %t3 = xor i64 %t2, %b
+  %t4 = mul nsw i64 %t3, %t2
+  %t5 = sub nsw i64 %t4, %t1
+  %t6 = shl i64 %t5, 3
+  %t7 = or i64 %t6, %t3
+  %t8 = mul nsw i64 %t7, %t5
+  ret i64 %t8
+}
+
+; CHECK-LABEL: @g2
+; CHECK: %q = sub nsw i64 %p, %b
+; CHECK-NEXT: [[R4:%[0-9]+]] = tail call i64 [[Tail]](i64 %q, i64 %b)
+; CHECK-NEXT: ret i64 [[R4]]
+define i64 @g2(i64 %a, i64 %b) {
+entry:
+  %p = sdiv i64 %a, 5
+  %q = sub nsw i64 %p, %b
+  %t1 = mul nsw i64 %q, %b
+  %t2 = add nsw i64 %t1, %q
+  %t3 = xor i64 %t2, %b
+  %t4 = mul nsw i64 %t3, %t2
+  %t5 = sub nsw i64 %t4, %t1
+  %t6 = shl i64 %t5, 3
+  %t7 = or i64 %t6, %t3
+  %t8 = mul nsw i64 %t7, %t5
+  ret i64 %t8
+}
+
+; CHECK: define private i64 [[Tail]](i64 %q, i64 %b)
+; CHECK: ret i64 %t8
+
+define i32 @main() {
+entry:
+  %call = call i32 @f1(i32 3, i32 5)
+  %call1 = call i32 @f2(i32 30, i32 -2)
+  %call2 = call i32 @f3(i32 4, i32 9)
+  %s1 = add i32 %call, %call1
+  %sum = add i32 %s1, %call2
+  %call3 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.str, i32 0, i32 0), i32 %sum)
+  %call4 = call i64 @g1(i64 3, i64 7)
+  %call5 = call i64 @g2(i64 40, i64 -3)
+  %sum1 = add i64 %call4, %call5
+  %call6 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([5 x i8], [5 x i8]* @.str.1, i32 0, i32 0), i64 %sum1)
+  ret i32 0
+}
+
+declare i32 @printf(i8*, ...)
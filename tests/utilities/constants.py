@@ -5,6 +5,7 @@ import os
 g_optimization = "-mergebb"
 g_optimization_force = "-mergebb-force"
 g_loadOptimization = os.path.dirname(os.path.abspath(__file__)) + "/../../build/libIRMergeBB.so"
+g_mergebbTool = os.path.dirname(os.path.abspath(__file__)) + "/../../build/tools/mergebb/mergebb"
 
 g_opt = "opt"
 g_lli = "lli"
@@ -13,6 +14,11 @@ g_link = "llvm-link"
 g_optWithLoad = g_opt + " -load " + g_loadOptimization + " " + g_optimization
 g_testPath = os.path.dirname(os.path.abspath(__file__)) + "/testCases"
 
+g_clang = "clang"
+g_clangpp = "clang++"
+g_lldFlag = "-fuse-ld=lld"
+g_benchPath = os.path.dirname(os.path.abspath(__file__)) + "/../benchmarks"
+
 g_armRoot = "/usr/arm-linux-gnueabihf/"
 g_extraCppInclude = g_armRoot + "include/c++/6.3.1/arm-linux-gnueabihf"
 
@@ -46,6 +52,8 @@ g_arches = {"x64": {"clang++": ArchInfo(g_clangX64Arch), "clang": ArchInfo(g_cla
                     "llc": ArchInfo("-march=arm"), "size": ArchInfo("arm-linux-gnueabihf-size") }}
 
 g_commonDir = "tmpFactored"
+g_benchDir = g_commonDir + "/bench"
+g_perfCount = g_benchDir + "/perfcount"
 
 # print colors
 g_cgreen = '\33[32m'
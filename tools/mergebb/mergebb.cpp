@@ -0,0 +1,229 @@
+//===-- mergebb.cpp - Standalone driver for MergeBB pass ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Runs MergeBB pass without opt. Input bitcode is memory mapped and function
+/// bodies are loaded lazily: the first scan materializes functions one by one
+/// in its own context, computes fingerprints of their basic blocks and drops
+/// the bodies. Then only functions, which contain a block with a fingerprint
+/// shared with another function, and single-block functions, whose tails may
+/// be shared, are materialized for the pass. Bitcode reader can't reload a
+/// dropped body, so the scan's module isn't reused, and the pass computes
+/// fingerprints of candidates again.
+///
+/// The rest of the functions are loaded just before writing the result,
+/// because bitcode writer needs all bodies. So the peak of memory is the
+/// whole module at writing, as with -no-lazy, while the pass and its cost
+/// model run only with candidates in memory (-debug-only=mergebb-tool prints
+/// the heap at every stage).
+///
+//===----------------------------------------------------------------------===//
+
+#include "BlockSharing.h"
+#include "CompareBB.h"
+#include "MergeBB.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+
+#define DEBUG_TYPE "mergebb-tool"
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFilename(cl::Positional,
+                                          cl::desc("<input bitcode>"),
+                                          cl::init("-"));
+
+static cl::opt<std::string> OutputFilename("o",
+                                           cl::desc("Override output filename"),
+                                           cl::value_desc("filename"),
+                                           cl::init("-"));
+
+static cl::opt<bool> OutputAssembly("S",
+                                    cl::desc("Write output as LLVM assembly"));
+
+static cl::opt<bool>
+    NoLazy("no-lazy", cl::desc("Materialize the whole module before merging. "
+                               "Merging is the same, but it takes more "
+                               "memory"));
+
+static cl::opt<bool> DisableVerify("disable-verify",
+                                   cl::desc("Do not verify result module"));
+
+/// Scans lazily loaded module function by function.
+/// \return bit vector, indexed by position of function in the module, set for
+/// functions, that contain a basic block with the fingerprint, shared with a
+/// block of another function or of the same function, and for candidates of
+/// tail sharing
+static Expected<BitVector> findCandidates(MemoryBufferRef Buffer) {
+  // types, constants and metadata of the scan are freed with its context
+  LLVMContext ScanContext;
+  Expected<std::unique_ptr<Module>> MOrErr =
+      getLazyBitcodeModule(Buffer, ScanContext);
+  if (!MOrErr)
+    return MOrErr.takeError();
+  Module &M = **MOrErr;
+
+  BitVector Candidates(M.size());
+  // fingerprint -> position of the first function with it
+  DenseMap<BBComparator::BasicBlockHash, unsigned> Fingerprints;
+
+  unsigned Id = 0;
+  for (Function &F : M) {
+    unsigned Current = Id++;
+    if (F.hasAvailableExternallyLinkage() || F.isDeclaration())
+      continue;
+    if (Error Err = F.materialize())
+      return std::move(Err);
+
+    // tails are shared between single-block functions after merging
+    if (SharedTail::isCandidate(F))
+      Candidates.set(Current);
+    for (const BasicBlock &BB : F) {
+      if (skipFromMerging(&BB))
+        continue;
+      auto Inserted = Fingerprints.insert(
+          std::make_pair(BBComparator::basicBlockHash(BB), Current));
+      if (!Inserted.second) {
+        Candidates.set(Inserted.first->second);
+        Candidates.set(Current);
+      }
+    }
+    // the module is thrown away, so the body is not needed anymore
+    F.deleteBody();
+  }
+
+  DEBUG(dbgs() << "Candidate functions: " << Candidates.count() << " of "
+               << M.size() << "\n");
+  return std::move(Candidates);
+}
+
+/// Loads module with only \p Candidates materialized
+static Expected<std::unique_ptr<Module>>
+loadCandidates(MemoryBufferRef Buffer, LLVMContext &Context,
+               const BitVector &Candidates) {
+  Expected<std::unique_ptr<Module>> MOrErr =
+      getLazyBitcodeModule(Buffer, Context);
+  if (!MOrErr)
+    return MOrErr.takeError();
+
+  unsigned Id = 0;
+  for (Function &F : **MOrErr) {
+    if (Candidates.test(Id++))
+      if (Error Err = F.materialize())
+        return std::move(Err);
+  }
+  return MOrErr;
+}
+
+static std::unique_ptr<TargetMachine> createTargetMachine(const Module &M) {
+  std::string Error;
+  Triple TheTriple(M.getTargetTriple().empty() ? sys::getDefaultTargetTriple()
+                                              : M.getTargetTriple());
+  const Target *TheTarget =
+      TargetRegistry::lookupTarget(TheTriple.getTriple(), Error);
+  if (!TheTarget) {
+    DEBUG(dbgs() << "Can't get target: " << Error << "\n");
+    return nullptr;
+  }
+  return std::unique_ptr<TargetMachine>(TheTarget->createTargetMachine(
+      TheTriple.getTriple(), "", "", TargetOptions(), None));
+}
+
+int main(int argc, char **argv) {
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+  ExitOnError ExitOnErr(std::string(argv[0]) + ": ");
+
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllTargetInfos();
+  InitializeAllAsmPrinters();
+
+  cl::ParseCommandLineOptions(argc, argv, "Merge identical basic blocks\n");
+
+  LLVMContext Context;
+
+  // large files are memory mapped
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
+      MemoryBuffer::getFileOrSTDIN(InputFilename);
+  if (std::error_code EC = BufferOrErr.getError()) {
+    errs() << argv[0] << ": " << InputFilename << ": " << EC.message() << "\n";
+    return 1;
+  }
+  MemoryBufferRef Buffer = (*BufferOrErr)->getMemBufferRef();
+
+  std::unique_ptr<Module> M;
+  bool IsBitcode =
+      isBitcode(reinterpret_cast<const unsigned char *>(Buffer.getBufferStart()),
+                reinterpret_cast<const unsigned char *>(Buffer.getBufferEnd()));
+  if (IsBitcode && !NoLazy) {
+    BitVector Candidates = ExitOnErr(findCandidates(Buffer));
+    M = ExitOnErr(loadCandidates(Buffer, Context, Candidates));
+    DEBUG(dbgs() << "Heap with candidates: " << sys::Process::GetMallocUsage()
+                 << " bytes\n");
+  } else {
+    SMDiagnostic Err;
+    M = parseIR(Buffer, Err, Context);
+    if (!M) {
+      Err.print(argv[0], errs());
+      return 1;
+    }
+  }
+
+  std::unique_ptr<TargetMachine> TM = createTargetMachine(*M);
+
+  mergeBasicBlocks(*M, TM.get());
+  DEBUG(dbgs() << "Heap after merging: " << sys::Process::GetMallocUsage()
+               << " bytes\n");
+
+  // bitcode writer needs bodies of all functions
+  ExitOnErr(M->materializeAll());
+  DEBUG(dbgs() << "Heap at writing: " << sys::Process::GetMallocUsage()
+               << " bytes\n");
+
+  if (!DisableVerify && verifyModule(*M, &errs())) {
+    errs() << argv[0] << ": result module is broken\n";
+    return 1;
+  }
+
+  std::error_code EC;
+  tool_output_file Out(OutputFilename, EC,
+                       OutputAssembly ? sys::fs::F_Text : sys::fs::F_None);
+  if (EC) {
+    errs() << argv[0] << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  if (OutputAssembly)
+    M->print(Out.os(), nullptr);
+  else
+    WriteBitcodeToFile(M.get(), Out.os());
+
+  Out.keep();
+  return 0;
+}